@@ -6,113 +6,82 @@
  *
  * Compile with -std=gnu99
  */
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <limits.h>
 #include <unistd.h>
-#include <stdarg.h>
+#include <getopt.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
 #include <locale.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #ifdef DEBUG
 #include <mcheck.h>
 #endif
-#if !defined(__GNUC__) && defined(sun)
-#define inline
-#endif
+#include "estscan.h"
 
-#define BUF_SIZE 4096
-#define MT_UNKNOWN -1
-#define MT_CODING 0
-#define MT_UNTRANSLATED 1
-#define MT_START 2
-#define MT_STOP 3
-#define MT_COUNT 4
+/* Output formats, see -f.  */
+#define FMT_FASTA 0
+#define FMT_GFF3 1
+#define FMT_BED 2
+#define FMT_TSV 3
 
 #define min(x, y)       ((x > y) ? (y) : (x))
 #define max(x, y)       ((x < y) ? (y) : (x))
 
-typedef struct _matrix {
-  signed char **m;
-  char *name;
-  char *kind;
-  double CGmin;
-  double CGmax;
-  int matType;
-  unsigned int order;
-  unsigned int frames;
-  int offset;
-} matrix_t, *matrix_p_t;
-
-typedef struct _read_buf_t {
-  char *line;
-  unsigned int lmax;
-  unsigned int lc;
-  unsigned int ic;
-  char in[BUF_SIZE];
-} read_buf_t, *read_buf_p_t;
-
-typedef struct _seq_t {
-  const char *fName;
-  char *header;
-  unsigned char *seq;
-  double GC_pct;
-  read_buf_t rb;
-  int fd;
-  unsigned int len;
-  unsigned int maxHead;
-  unsigned int max;
-} seq_t, *seq_p_t;
-
-typedef struct _result_t {
-  unsigned char *s;
-  int score;
-  unsigned int start;
-  unsigned int stop;
-  int reverse;
-} result_t, *result_p_t;
-
-typedef union _col_elt_t {
-  void **elt;
-  matrix_p_t *m;
-  result_p_t *r;
-} col_elt_t;
-
-typedef struct _col_t {
-  col_elt_t e;
-  unsigned int size;
-  unsigned int nb;
-} col_t, *col_p_t;
-
 typedef struct _options_t {
   FILE *out;
   FILE *transl;
+  /* Names of the outputs, opened once all options are known: - is
+     stdout, and NULL no output.  */
+  const char *outName;
+  const char *translName;
+  char **inputs;
+  unsigned int nInputs;
+  /* Checkpoint file of the run, see --checkpoint.  */
+  const char *checkpoint;
+  unsigned int ckEvery;
+  int resume;
   char *matrix;
-  double percent;
   double both;
-  int min;
-  int dPen;
-  int iPen;
-  int ts5uPen;
-  int tscPen;
-  int ts3uPen;
-  int t5ucPen;
-  int t5uePen;
-  int tc3uPen;
-  int tcePen;
-  int t3uePen;
-  int Nvalue;
+  params_t p;
   unsigned int sWidth;
   int all;
   int maxOnly;
   int skipLen;
-  int minLen;
   int no_del;
+  int protOnly;
+  int format;
+  int cacheMB;
+  unsigned int streamMin;
+  unsigned int parMin;
+  /* Byte range of the input files, or shard of them when shards is not
+     0, whose records are scanned.  */
+  size_t rangeStart;
+  size_t rangeEnd;
+  unsigned int shard;
+  unsigned int shards;
+  /* File of the identifiers of the records to scan, see --ids.  */
+  const char *ids;
+  int index;
+  int merge;
   int single;
+  int threads;
 } options_t;
 
 static const char Version[] =
@@ -121,19 +90,43 @@ static const char Version[] =
 "All rights reserved. See the file COPYRIGHT for details.\n";
 
 static const char Usage[] =
-"%s [options] [<FASTA file> ...]\n\n"
+"%s [options] [<FASTA file> ...]\n"
+"%s --index <FASTA file> ...\n"
+"%s --merge [-o <file>] <output file> ...\n\n"
+#if defined(HAVE_ZLIB) && defined(HAVE_ZSTD)
+"FASTA files may be gzip or zstd compressed, and output files whose name\n"
+"ends with .gz or .zst are written compressed.\n\n"
+#elif defined(HAVE_ZLIB)
+"FASTA files may be gzip compressed, and output files whose name ends\n"
+"with .gz are written compressed.\n\n"
+#endif
 #ifdef DEBUG
 "Debug version\n\n"
 #endif
 "Available options (default value in braces[]):\n"
-"  -a          All in one sequence output\n"
+"  -a          All in one sequence output: each sequence, in lower case, with\n"
+"              the results above -b in place, on the strand of the best one\n"
 "  -b <float>  only results are shown, which have scores higher than this \n"
 "              fraction of the best score [%f].\n"
+"  -C <file>   compile the score matrices, for the given -m and -N, into a\n"
+"              binary model file, which -M loads much faster, and exit\n"
+"  -c <int>    keep the results of up to this many MB of sequences, to\n"
+"              reuse for their duplicates and reverse complements [%d]\n"
 "  -d <int>    deletion penalty [%d]\n"
+"  -f <fmt>    output format: fasta, or gff3, bed or tsv for the coordinates,\n"
+"              strand, score and edits of the results only, the BED\n"
+"              scores out of 1000 for the best one [fasta]\n"
+"  -G <int>    scan each strand of the sequences at least this long with -j\n"
+"              threads at once, at least two, 0 for none [%u]\n"
 "  -h          print this usage information\n"
 "  -i <int>    insertion penalty [%d]\n"
+"  -j <int>    number of worker threads, 0 to scan in the main thread [%d]\n"
+"  -L <int>    scan the sequences at least this long as a stream, in memory\n"
+"              bounded by the unresolved part of their best path, reading\n"
+"              them in place in uncompressed files, 0 for none [%u]\n"
 "  -l <int>    only results longer than this length are shown [%d]\n"
-"  -M <file>   score matrices file ($ESTSCANDIR/Hs.smat)\n"
+"  -M <file>   score matrices file, text or compiled with -C\n"
+"              ($ESTSCANDIR/Hs.smat)\n"
 "              [%s]\n"
 "  -m <int>    min value in matrix [%d]\n"
 "  -N <int>    how to compute the score of N [%d]\n"
@@ -141,6 +134,8 @@ static const char Usage[] =
 "  -O          report header information for best match only\n"
 "  -o <file>   send output to file.  - means stdout.  If both -t and -o specify\n"
 "              stdout, only proteins will be written.\n"
+"  -P          only write the proteins, to the -t file or else to stdout,\n"
+"              without building the nucleotide sequences\n"
 "  -p <float>  GC select correction for score matrices [%f]\n"
 "  -S          only analyze positive strand\n"
 "  -s <int>    Skip sequences shorter than length [%d]\n"
@@ -151,31 +146,55 @@ static const char Usage[] =
 "  -t <file>   Translate to protein.  - means stdout.\n"
 "              will go to the file and the nucleotides will still go to stdout.\n"
 "  -v          version information\n"
-"  -w <int>    width of the FASTA sequence output [%d]\n";
+"  -w <int>    width of the FASTA sequence output [%d]\n"
+"  --byte-range <start>:<end>\n"
+"              only scan the records whose header starts in this byte range\n"
+"              of each uncompressed input file, up to its end if <end> is\n"
+"              left out\n"
+"  --checkpoint <file>\n"
+"              save to this file, every --checkpoint-every seconds, how far\n"
+"              the run has written its records out, for --resume, which\n"
+"              needs uncompressed -o and -t files\n"
+"  --checkpoint-every <int>\n"
+"              seconds between checkpoints [%u]\n"
+"  --ids <file>\n"
+"              only scan the records whose identifiers are listed in this\n"
+"              file, in its order, read directly from the uncompressed input\n"
+"              files with the index of each\n"
+"  --index     write the index of each uncompressed input file, as samtools\n"
+"              faidx does, to <FASTA file>.fai, with the C+G percentage of\n"
+"              each record in a sixth column\n"
+"  --merge     concatenate the outputs of the shards of a run, given in\n"
+"              order, to -o without repeating the GFF3 or TSV header lines\n"
+"  --resume    resume the run from its --checkpoint, if any, after the\n"
+"              last record written out, which ends the kept outputs\n"
+"  --shard <i>/<n>\n"
+"              only scan the records whose header starts in the i-th of n\n"
+"              equal byte ranges of each uncompressed input file\n";
+
+#define OPT_BYTE_RANGE 256
+#define OPT_CHECKPOINT 257
+#define OPT_CHECKPOINT_EVERY 258
+#define OPT_IDS 259
+#define OPT_INDEX 260
+#define OPT_MERGE 261
+#define OPT_RESUME 262
+#define OPT_SHARD 263
+
+static const struct option LongOptions[] = {
+  {"byte-range", required_argument, NULL, OPT_BYTE_RANGE},
+  {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+  {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+  {"ids", required_argument, NULL, OPT_IDS},
+  {"index", no_argument, NULL, OPT_INDEX},
+  {"merge", no_argument, NULL, OPT_MERGE},
+  {"resume", no_argument, NULL, OPT_RESUME},
+  {"shard", required_argument, NULL, OPT_SHARD},
+  {NULL, 0, NULL, 0}
+};
 
 static options_t options;
-static char *argv0;
-
-/* declaration of indexes also used in getFrame */
-static int iBegin, i5utr, iStart, iCds, iStop, i3utr;
-/* next tsize states implement insertion/deletion after nucleotide in frame index */
-static int iInsAfter[3], iDelAfter[3];
-/* last tsize states implemented insertion/deletion before nucleotide in frame index */
-static int iInsNext[3], iDelNext[3];
-
-static unsigned int maxSize = 0;
-static int *V  = NULL;
-static int *tr = NULL;
-
-static const unsigned char dna_complement[256] =
-  "                                                                "
-  " TVGH  CD  M KN   YSA BWXR       tvgh  cd  m kn   ysa bwxr      "
-  "                                                                "
-  "                                                                ";
-/* ................................................................ */
-/* @ABCDEFGHIJKLMNOPQRSTUVWXYZ[\]^_`abcdefghijklmnopqrstuvwxyz{|}~. */
-/* ................................................................ */
-/* ................................................................ */
+static const char *argv0;
 
 #ifdef __GNUC__
 static void
@@ -190,7 +209,7 @@ fatal(const char *fmt, ...)
   va_start(ap, fmt);
   fflush(stdout);
   if (argv0) {
-    char *p = strrchr(argv0, '/');
+    const char *p = strrchr(argv0, '/');
     fprintf(stderr, "%s: ", p ? p+1 : argv0);
   }
   vfprintf(stderr, fmt, ap);
@@ -202,14 +221,6 @@ fatal(const char *fmt, ...)
 #endif
 }
 
-static int
-intCompare(const void *a, const void *b)
-{
-  int ia = * (int *) a;
-  int ib = * (int *) b;
-  return ia < ib ? -1 : (ia > ib ? 1 : 0);
-}
-
 static void *
 xmalloc(size_t size)
 {
@@ -220,18 +231,6 @@ xmalloc(size_t size)
   return res;
 }
 
-#if 0
-static void *
-xcalloc(size_t nmemb, size_t size)
-{
-  void *res = calloc(nmemb, size);
-  if (res == NULL)
-    fatal("calloc of %zd, %zd failed: %s (%d)\n", nmemb, size,
-	  strerror(errno), errno);
-  return res;
-}
-#endif
-
 static void *
 xrealloc(void *ptr, size_t size)
 {
@@ -242,1035 +241,783 @@ xrealloc(void *ptr, size_t size)
   return res;
 }
 
-static void
-grow_read_buf(read_buf_p_t b)
+#ifdef HAVE_ZLIB
+static ssize_t
+gz_write(void *cookie, const char *buf, size_t size)
 {
-  b->lmax += BUF_SIZE;
-  b->line = xrealloc(b->line, b->lmax * sizeof(char));
+  if (size == 0)
+    return 0;
+  return gzwrite((gzFile) cookie, buf, size) > 0 ? (ssize_t) size : -1;
 }
 
-static char *
-shuffle_line(read_buf_p_t b, size_t *cur)
+static int
+gz_close(void *cookie)
 {
-  if (b->ic == 0 || *cur >= b->ic)
-    return NULL;
-  /* Make sure we have enough room in line.  */
-  if (b->lmax <= b->lc + (b->ic - *cur))
-    grow_read_buf(b);
-  while (*cur < b->ic && b->in[*cur] != '\n')
-    b->line[b->lc++] = b->in[(*cur)++];
-  if (*cur < b->ic) {
-    /* Ok, we have our string.  */
-    /* Copy the newline.  */
-    b->line[b->lc++] = b->in[(*cur)++];
-    /* We should be fine, since we read BUF_SIZE -1 at most...  */
-    b->line[b->lc] = 0;
-    /* Adjust the input buffer.  */
-    if (*cur < b->ic) {
-      memmove(b->in, b->in + *cur, (b->ic - *cur) * sizeof(char));
-      b->ic -= *cur;
-    } else
-      b->ic = 0;
-    *cur = 0;
-    return b->line;
-  }
-  /* Go read some more.  */
-  b->ic = 0, *cur = 0;
-  return NULL;
+  return gzclose((gzFile) cookie) == Z_OK ? 0 : -1;
 }
+#endif
 
-static char *
-read_line_buf(read_buf_p_t b, int fd)
-{
-  char *s = NULL;
-  ssize_t rc;
-  size_t cur = 0;
-  b->lc = 0;
-  if ((s = shuffle_line(b, &cur)) != NULL)
-    return s;
+#ifdef HAVE_ZSTD
+typedef struct _zstd_out_t {
+  ZSTD_CStream *z;
+  FILE *f;
+  void *buf;
+  size_t size;
+} zstd_out_t, *zstd_out_p_t;
+
+/* Compress buf, or end the frame if buf is NULL.  */
+static ssize_t
+zstd_write(void *cookie, const char *buf, size_t size)
+{
+  zstd_out_p_t zo = (zstd_out_p_t) cookie;
+  ZSTD_inBuffer in;
+  size_t res;
+  in.src = buf;
+  in.size = size;
+  in.pos = 0;
   do {
-    if ((rc = read(fd, b->in + b->ic, BUF_SIZE - b->ic - 1)) == -1) {
-      if (errno != EINTR)
-	fatal("Could not read from %d: %s(%d)\n",
-	      fd, strerror(errno), errno);
-    } else
-      b->ic += rc;
-    s = shuffle_line(b, &cur);
-    if (s == NULL && rc == 0) {
-      /* Got to the EOF...  */
-      b->line[b->lc] = 0;
-      s = b->line;
+    ZSTD_outBuffer out;
+    out.dst = zo->buf;
+    out.size = zo->size;
+    out.pos = 0;
+    if (buf != NULL)
+      res = ZSTD_compressStream(zo->z, &out, &in);
+    else
+      res = ZSTD_endStream(zo->z, &out);
+    if (ZSTD_isError(res) || fwrite(zo->buf, 1, out.pos, zo->f) != out.pos)
+      return -1;
+  } while (buf != NULL ? in.pos < in.size : res != 0);
+  return size;
+}
+
+static int
+zstd_close(void *cookie)
+{
+  zstd_out_p_t zo = (zstd_out_p_t) cookie;
+  int res = zstd_write(cookie, NULL, 0) == 0 ? 0 : -1;
+  if (fclose(zo->f) != 0)
+    res = -1;
+  ZSTD_freeCStream(zo->z);
+  free(zo->buf);
+  free(zo);
+  return res;
+}
+#endif
+
+/* Open fName for writing, compressed if its name ends with .gz or
+   .zst, which needs the build to support that format.  */
+static FILE *
+open_output(const char *fName)
+{
+  size_t len = strlen(fName);
+  FILE *f = NULL;
+  if (len > 3 && strcmp(fName + len - 3, ".gz") == 0) {
+#ifdef HAVE_ZLIB
+    cookie_io_functions_t io = { NULL, gz_write, NULL, gz_close };
+    gzFile gz = gzopen(fName, "wb");
+    if (gz != NULL && (f = fopencookie(gz, "w", io)) == NULL)
+      gzclose(gz);
+#else
+    fatal("Cannot compress %s, not built with zlib support\n", fName);
+#endif
+  } else if (len > 4 && strcmp(fName + len - 4, ".zst") == 0) {
+#ifdef HAVE_ZSTD
+    cookie_io_functions_t io = { NULL, zstd_write, NULL, zstd_close };
+    zstd_out_p_t zo = (zstd_out_p_t) xmalloc(sizeof(zstd_out_t));
+    zo->z = ZSTD_createCStream();
+    zo->size = ZSTD_CStreamOutSize();
+    zo->buf = xmalloc(zo->size);
+    if (zo->z == NULL || ZSTD_isError(ZSTD_initCStream(zo->z, 3)))
+      fatal("Could not initialize zstd for %s\n", fName);
+    if ((zo->f = fopen(fName, "w")) != NULL
+	&& (f = fopencookie(zo, "w", io)) == NULL)
+      fclose(zo->f);
+    if (f == NULL) {
+      ZSTD_freeCStream(zo->z);
+      free(zo->buf);
+      free(zo);
     }
-  } while (s == NULL);
-  return s;
+#else
+    fatal("Cannot compress %s, not built with zstd support\n", fName);
+#endif
+  } else
+    f = fopen(fName, "w");
+  if (f == NULL)
+    fatal("Couldn't create file %s: %s (%d)\n", fName, strerror(errno), errno);
+  return f;
 }
 
-static void
-init_buf(read_buf_p_t b)
+/* Open the uncompressed file fName for writing after its first at
+   bytes, which are kept.  */
+static FILE *
+open_output_at(const char *fName, size_t at)
 {
-  b->line = xmalloc(BUF_SIZE * sizeof(char));
-  b->lmax = BUF_SIZE;
-  b->lc = 0;
-  b->ic = 0;
+  struct stat st;
+  FILE *f = NULL;
+  int fd = open(fName, O_WRONLY | O_CREAT, 0666);
+  if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+      && (size_t) st.st_size < at)
+    fatal("File %s is shorter than its checkpoint\n", fName);
+  if (fd == -1 || ftruncate(fd, at) != 0 || lseek(fd, at, SEEK_SET) == -1
+      || (f = fdopen(fd, "w")) == NULL)
+    fatal("Couldn't create file %s: %s (%d)\n", fName, strerror(errno), errno);
+  return f;
 }
 
-static void
-free_buf(read_buf_p_t b)
+/* Open the output fName, - being stdout, keeping the first at bytes of
+   the files of a run with checkpoints.  */
+static FILE *
+open_named(const char *fName, size_t at)
 {
-  free(b->line);
+  if (fName == NULL)
+    return NULL;
+  if (strcmp(fName, "-") == 0)
+    return stdout;
+  if (options.checkpoint != NULL)
+    return open_output_at(fName, at);
+  return open_output(fName);
 }
 
+/* Close an output file, flushing whatever compressed data is left.  */
 static void
-init_seq(const char *fName, seq_p_t sp)
-{
-  sp->fName = fName;
-  sp->header = NULL;
-  sp->seq = NULL;
-  init_buf(&sp->rb);
-  if (fName != NULL) {
-    sp->fd = open(fName, O_RDONLY);
-    if (sp->fd == -1)
-      fatal("Could not open file %s: %s(%d)\n",
-	    fName, strerror(errno), errno);
-  } else
-    sp->fd = 0;
-  sp->len = 0;
-  sp->maxHead = 0;
-  sp->max = 0;
-  read_line_buf(&sp->rb, sp->fd);
+close_output(FILE *f)
+{
+  if (f != NULL && f != stdout && fclose(f) != 0)
+    fatal("Could not write output: %s (%d)\n", strerror(errno), errno);
 }
 
-static int
-get_next_seq(seq_p_t sp)
+/* The records are formatted into large buffers, which a writer thread
+   hands to the output files, with writev when they are not compressed.
+   A buffer holds segments for both files, in the order they were
+   written.  */
+#define OUT_BUF_SIZE (256 * 1024)
+#define OUT_BUFS 4
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct _out_seg_t {
+  int dest;
+  size_t len;
+} out_seg_t;
+
+/* Point of a run up to which all the records are written out: the input
+   file and the offset in it of the next record, and the sizes of the
+   outputs, in the order of the files of the writer.  */
+typedef struct _ckpt_t {
+  unsigned int file;
+  size_t in;
+  size_t out[2];
+} ckpt_t;
+
+typedef struct _out_buf_t {
+  char *data;
+  size_t len;
+  size_t max;
+  out_seg_t *seg;
+  unsigned int nSeg;
+  unsigned int segMax;
+  /* The records up to the first markLen bytes end at mark, if marked,
+     see out_mark.  */
+  int marked;
+  size_t markLen;
+  ckpt_t mark;
+} out_buf_t, *out_buf_p_t;
+
+typedef struct _writer_t {
+  /* Nucleotide and protein outputs, the latter being NULL when both go
+     to the same file.  Compressed files have no descriptor, and are
+     written through their stream.  */
+  FILE *f[2];
+  int fd[2];
+  int aa;
+  out_buf_t bufs[OUT_BUFS];
+  /* Buffer being filled, since flushed, and buffers queued for the
+     writer.  */
+  out_buf_p_t cur;
+  time_t flushed;
+  unsigned int fill;
+  unsigned int queued;
+  int done;
+  /* Bytes written to the files, and the last point of the run they
+     hold, saved to the checkpoint file every ckEvery seconds.  */
+  size_t written[2];
+  ckpt_t ck;
+  int ckNew;
+  time_t ckLast;
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t room;
+} writer_t, *writer_p_t;
+
+#define OUT_NT 0
+#define OUT_AA (writer.aa)
+
+static writer_t writer;
+
+static void
+write_fd(int fd, struct iovec *iov, int cnt)
 {
-  const int lenStr = 24;
-  unsigned int headerLen;
-  char *buf = sp->rb.line;
-  int res;
-  unsigned int ctr[256], gc, atgc;
-  ctr['A'] = ctr['C'] = ctr['G'] = ctr['T'] = 0;
-  while (sp->rb.lc > 0 && buf[0] != '>')
-    buf = read_line_buf(&sp->rb, sp->fd);
-  if (sp->rb.lc == 0)
-    return -1;
-  /* We have the FASTA header.  */
-  if (sp->rb.lc + lenStr + 1 > sp->maxHead) {
-    sp->maxHead = sp->rb.lc + lenStr + 1;
-    sp->header = (char *) xrealloc(sp->header, sp->maxHead * sizeof(char));
-  }
-  headerLen = sp->rb.lc;
-  memcpy(sp->header, buf, (sp->rb.lc + 1) * sizeof(char));
-  sp->len = 0;
-  buf = read_line_buf(&sp->rb, sp->fd);
-  while (sp->rb.lc > 0 && buf[0] != '>') {
-    unsigned char c;
-    /* Make sure we have enough room for this additional line.  */
-    if (sp->len + sp->rb.lc + 1 > sp->max) {
-      sp->max = max(sp->len + sp->rb.lc + 1,
-		    sp->max + 0x40000);
-      sp->seq = (unsigned char *)
-	xrealloc(sp->seq, sp->max * sizeof(unsigned char));
-    }
-    while ((c = *buf++) != 0) {
-      if (isupper(c)) {
-	ctr[c] += 1;
-	sp->seq[sp->len++] = c;
-      } else if (islower(c)) {
-	c = toupper(c);
-	ctr[c] += 1;
-	sp->seq[sp->len++] = c;
-      }
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      fatal("Could not write output: %s (%d)\n", strerror(errno), errno);
     }
-    buf = read_line_buf(&sp->rb, sp->fd);
-  }
-  sp->seq[sp->len] = 0;
-  buf = strstr(sp->header, " LEN=");
-  if (buf) {
-    char *s;
-    if (*(buf - 1) == ';') {
-      buf -= 1;
-      s = buf + 6;
-      headerLen -= 6;
-    } else {
-      s = buf + 5;
-      headerLen -= 5;
+    while (cnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov += 1;
+      cnt -= 1;
     }
-    while (isdigit(*s)) {
-      s += 1;
-      headerLen -= 1;
+    if (cnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
     }
-    while (*s)
-      *buf++ = *s++;
-  }
-  buf = sp->header + headerLen - 1;
-  while (iscntrl(*buf) || isspace(*buf))
-    buf -= 1;
-  res = snprintf(buf + 1, lenStr, "; LEN=%u\n", sp->len);
-  if (res < 0 || res >= lenStr)
-    fatal("Sequence too long: %u\n", sp->len);
-  gc = ctr['G'] + ctr['C'];
-  atgc = gc + ctr['A'] + ctr['T'];
-  sp->GC_pct = (atgc == 0) ? 0.0 : 100.0 * (double) gc / (double) atgc;
-  return 0;
+  }
 }
 
+/* Write the segments of b to their files.  */
 static void
-free_seq(seq_p_t sp)
+write_buf(writer_p_t w, out_buf_p_t b)
 {
-  free(sp->seq);
-  free(sp->header);
-  free_buf(&sp->rb);
-  if (sp->fName != NULL)
-    close(sp->fd);
+  struct iovec iov[IOV_MAX];
+  int d;
+  for (d = 0; d < 2; d++) {
+    char *p = b->data;
+    unsigned int i;
+    int cnt = 0;
+    if (w->f[d] == NULL)
+      continue;
+    for (i = 0; i < b->nSeg; p += b->seg[i++].len) {
+      if (b->seg[i].dest != d)
+	continue;
+      if (w->fd[d] < 0) {
+	if (fwrite(p, 1, b->seg[i].len, w->f[d]) != b->seg[i].len)
+	  fatal("Could not write output: %s (%d)\n", strerror(errno), errno);
+	continue;
+      }
+      if (cnt == IOV_MAX) {
+	write_fd(w->fd[d], iov, cnt);
+	cnt = 0;
+      }
+      iov[cnt].iov_base = p;
+      iov[cnt++].iov_len = b->seg[i].len;
+    }
+    if (cnt > 0)
+      write_fd(w->fd[d], iov, cnt);
+  }
+  b->len = 0;
+  b->nSeg = 0;
+  b->marked = 0;
 }
 
+/* Add the bytes of b to those written, and note the point of the run at
+   its mark.  */
 static void
-seq_revcomp_inplace(seq_p_t seq)
+count_buf(writer_p_t w, out_buf_p_t b)
 {
-  unsigned char *s = seq->seq;
-  unsigned char *t = seq->seq + seq->len;
-  unsigned char c;
-  while (s < t) {
-    c = dna_complement[*--t];
-    *t = dna_complement[*s];
-    *s++ = c;
+  size_t pos = 0;
+  unsigned int i;
+  if (b->marked) {
+    w->ck = b->mark;
+    w->ck.out[0] = w->written[0];
+    w->ck.out[1] = w->written[1];
+    w->ckNew = 1;
+  }
+  for (i = 0; i < b->nSeg; pos += b->seg[i++].len) {
+    int d = b->seg[i].dest;
+    if (b->marked && pos < b->markLen)
+      w->ck.out[d] += min(b->seg[i].len, b->markLen - pos);
+    w->written[d] += b->seg[i].len;
   }
 }
 
+/* Save the last point of the run to the checkpoint file, once the
+   outputs hold it for sure.  */
 static void
-init_col(col_p_t c, unsigned int size)
+save_checkpoint(writer_p_t w)
 {
-  c->size = size;
-  c->nb = 0;
-  if (size > 0)
-    c->e.elt = (void **) xmalloc(size * sizeof(void *));
-  else
-    c->e.elt = NULL;
+  const char *fName = options.checkpoint;
+  char *tmp = (char *) xmalloc(strlen(fName) + 5);
+  FILE *f;
+  int d;
+  for (d = 0; d < 2; d++)
+    if (w->fd[d] >= 0 && fdatasync(w->fd[d]) != 0)
+      fatal("Could not write output: %s (%d)\n", strerror(errno), errno);
+  strcat(strcpy(tmp, fName), ".tmp");
+  if ((f = fopen(tmp, "w")) == NULL)
+    fatal("Couldn't create file %s: %s (%d)\n", tmp, strerror(errno), errno);
+  fprintf(f, "# input file, offset of its next record, output sizes, "
+	  "input name\n%u %zu %zu %zu %s\n", w->ck.file, w->ck.in,
+	  w->ck.out[0], w->ck.out[1], options.nInputs > 0
+	  ? options.inputs[w->ck.file] : "-");
+  if (fflush(f) != 0 || fdatasync(fileno(f)) != 0 || fclose(f) != 0
+      || rename(tmp, fName) != 0)
+    fatal("Could not write %s: %s (%d)\n", fName, strerror(errno), errno);
+  free(tmp);
+  w->ckNew = 0;
+  w->ckLast = time(NULL);
 }
 
-static void
-add_col_elt(col_p_t c, void *elt, unsigned int grow)
+static void *
+writer_main(void *arg)
 {
-  if (c->size <= c->nb) {
-    c->size += grow;
-    c->e.elt = (void **) xrealloc(c->e.elt, c->size * sizeof(void *));
+  writer_p_t w = (writer_p_t) arg;
+  unsigned int next = 0;
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    out_buf_p_t b;
+    while (w->queued == 0 && !w->done)
+      pthread_cond_wait(&w->work, &w->lock);
+    if (w->queued == 0)
+      break;
+    pthread_mutex_unlock(&w->lock);
+    b = w->bufs + next % OUT_BUFS;
+    if (options.checkpoint != NULL)
+      count_buf(w, b);
+    write_buf(w, b);
+    if (w->ckNew && time(NULL) - w->ckLast >= (time_t) options.ckEvery)
+      save_checkpoint(w);
+    next += 1;
+    pthread_mutex_lock(&w->lock);
+    w->queued -= 1;
+    pthread_cond_signal(&w->room);
   }
-  c->e.elt[c->nb++] = elt;
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
 }
 
-#if 0 /* CI */
+/* Start the writer of out and transl, which already hold the sizes
+   given by ck.  */
 static void
-add_unique_col_elt(col_p_t c, void *elt, unsigned int grow)
+start_writer(FILE *out, FILE *transl, const ckpt_t *ck)
 {
+  writer_p_t w = &writer;
   unsigned int i;
-  for (i = 0; i < c->nb; i++)
-    if (c->e.elt[i] == elt)
-      return;
-  add_col_elt(c, elt, grow);
+  w->f[0] = out;
+  w->f[1] = transl;
+  w->aa = 1;
+  if (transl == out || out == NULL) {
+    w->f[0] = transl;
+    w->f[1] = NULL;
+    w->aa = 0;
+  }
+  for (i = 0; i < 2; i++) {
+    w->fd[i] = w->f[i] != NULL ? fileno(w->f[i]) : -1;
+    /* The buffers bypass the stream of uncompressed files.  */
+    if (w->fd[i] >= 0)
+      fflush(w->f[i]);
+  }
+  for (i = 0; i < OUT_BUFS; i++) {
+    w->bufs[i].max = OUT_BUF_SIZE;
+    w->bufs[i].data = (char *) xmalloc(w->bufs[i].max);
+    w->bufs[i].len = 0;
+    w->bufs[i].segMax = 64;
+    w->bufs[i].seg = (out_seg_t *) xmalloc(w->bufs[i].segMax
+					   * sizeof(out_seg_t));
+    w->bufs[i].nSeg = 0;
+    w->bufs[i].marked = 0;
+  }
+  w->written[0] = ck->out[0];
+  w->written[1] = ck->out[1];
+  w->ck = *ck;
+  w->ckNew = 0;
+  w->ckLast = time(NULL);
+  w->fill = 0;
+  w->cur = w->bufs;
+  w->flushed = time(NULL);
+  w->queued = 0;
+  w->done = 0;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->work, NULL);
+  pthread_cond_init(&w->room, NULL);
+  if ((errno = pthread_create(&w->tid, NULL, writer_main, w)) != 0)
+    fatal("Could not create thread: %s(%d)\n", strerror(errno), errno);
 }
 
+/* Queue the buffer being filled, and wait for the next one to be
+   written out.  */
 static void
-merge_col(col_p_t c1, col_p_t c2)
+out_flush(void)
 {
-  unsigned int i;
-  for (i = 0; i < c2->nb; i++)
-    add_col_elt(c1, c2->e.elt[i], COL_G_GROW);
+  writer_p_t w = &writer;
+  pthread_mutex_lock(&w->lock);
+  w->queued += 1;
+  w->fill += 1;
+  pthread_cond_signal(&w->work);
+  while (w->queued == OUT_BUFS)
+    pthread_cond_wait(&w->room, &w->lock);
+  pthread_mutex_unlock(&w->lock);
+  w->cur = w->bufs + w->fill % OUT_BUFS;
+  w->flushed = time(NULL);
 }
-#endif /* 0 CI */
 
 static void
-free_col(col_p_t c)
+stop_writer(void)
 {
-#ifndef NDEBUG
-  memset(c->e.elt, 0, c->size * sizeof(void *));
-#endif
-  free(c->e.elt);
-#ifndef NDEBUG
-  memset(c, 0, sizeof(col_t));
-#endif
+  writer_p_t w = &writer;
+  unsigned int i;
+  if (w->cur->len > 0 || w->cur->marked)
+    out_flush();
+  pthread_mutex_lock(&w->lock);
+  w->done = 1;
+  pthread_cond_signal(&w->work);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->tid, NULL);
+  if (w->ckNew)
+    save_checkpoint(w);
+  for (i = 0; i < OUT_BUFS; i++) {
+    free(w->bufs[i].data);
+    free(w->bufs[i].seg);
+  }
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->work);
+  pthread_cond_destroy(&w->room);
 }
 
-static void
-CreateMatrix(matrix_p_t m, signed char *data, unsigned int nElt)
+/* Room for len more bytes to dest at the end of the current buffer.  */
+static char *
+out_room(int dest, size_t len)
 {
-  int i;
-  unsigned int frame;
-  unsigned int sSize = 1;
-  unsigned int *step = (unsigned int *) xmalloc(sizeof(unsigned int)
-						* m->order);
-  unsigned int *sStep = (unsigned int *) xmalloc(sizeof(unsigned int)
-						 * m->order);
-
-  if (m->order < 1)
-    fatal("CreateMatrix: order should be >=1 (%d)", m->order);
-  m->m = (signed char **) xmalloc(sizeof(signed char *) * m->frames);
-  /* Compute some stepping info.  */
-  step[m->order - 1] = 4;
-  sStep[m->order - 1] = 5;
-  for (i = m->order - 2; i >= 0; i--) {
-    step[i] = step[i + 1] * 4;
-    sStep[i] = sStep[i + 1] * 5;
-  }
-  /* Check the size of the array.  */
-  if (step[0] * m->frames != nElt)
-    fatal("CreateMatrix: bad array size (%d, should be %d)",
-	  nElt, step[0] * m->frames);
-  /* Compute the score table size.  */
-  for (frame = 0; frame < m->order; frame++)
-    sSize *= 5;
-  for (frame = 0; frame < m->frames; frame++) {
-    signed char *ptr;
-    /* Get space for the score tables.  */
-    m->m[frame] = (signed char *) xmalloc(sizeof(signed char) * sSize);
-    ptr = m->m[frame];
-    /* Process the array.  */
-    for (i = 0; i < (int) step[0]; i++) {
-      int val = *data++;
-      int j;
-      /* Do not go below min.  */
-      val = (val < options.min) ? options.min : val;
-      *ptr++ = val;
-      for (j = m->order - 1; j >= 0; j--) {
-	if ((i + 1) % step[j] == 0) {
-	  /* We have to fill in the next sStep[j]/5 score slots.  */
-	  int k;
-	  int stepping = sStep[j] / 5;
-	  if (options.Nvalue == 0) {
-	    /* Plain average thing.  */
-	    for (k = 0; k < stepping - 1; k++) {
-	      int avg = *(ptr - stepping) + *(ptr - stepping * 2)
-		      + *(ptr - stepping * 3) + *(ptr - stepping * 4);
-	      avg /= 4;
-	      *ptr++ = avg;
-	    }
-	    *ptr++ = 0; /* Null expectation to accept an N.  */
-	  } else {
-	    /* Something a bit more funky...  */
-	    for (k = 0; k < stepping - 1; k++) {
-	      int avg;
-	      int sorted[4];
-	      sorted[0] = *(ptr - stepping);
-	      sorted[1] = *(ptr - stepping * 2);
-	      sorted[2] = *(ptr - stepping * 3);
-	      sorted[3] = *(ptr - stepping * 4);
-	      /* Need to sort the darn thing...  */
-	      qsort(sorted, 4, sizeof(int), intCompare);
-	      switch(options.Nvalue) {
-	      case 1:
-		avg = sorted[3];
-		break;
-	      case 2:
-		avg = (sorted[3] + sorted[2]) / 2;
-		break;
-	      case 3:
-		avg = (sorted[3] + sorted[2] + sorted[1]) / 3;
-		break;
-	      case -1:
-		avg = sorted[0];
-		break;
-	      case -2:
-		avg = (sorted[0] + sorted[1]) / 2;
-		break;
-	      case -3:
-		avg = (sorted[0] + sorted[1] + sorted[2]) / 3;
-		break;
-	      default:
-		fatal("Bad method (%d) to compute N score value.",
-		      options.Nvalue);
-	      }
-	      *ptr++ = avg;
-	    }
-	    *ptr++ = 0; /* Null expectation to accept an N.  */
-	  }
-	}
-      }
+  out_buf_p_t b = writer.cur;
+  if (b->len + len > b->max) {
+    b->max = max(2 * b->max, b->len + len);
+    b->data = (char *) xrealloc(b->data, b->max);
+  }
+  if (b->nSeg == 0 || b->seg[b->nSeg - 1].dest != dest) {
+    if (b->nSeg == b->segMax) {
+      b->segMax *= 2;
+      b->seg = (out_seg_t *) xrealloc(b->seg, b->segMax * sizeof(out_seg_t));
     }
+    b->seg[b->nSeg].dest = dest;
+    b->seg[b->nSeg++].len = 0;
   }
-  free(step);
-  free(sStep);
+  return b->data + b->len;
 }
 
-static inline unsigned int
-GetCode(unsigned char c)
+static void
+out_advance(size_t len)
 {
-  switch (c) {
-  case 'A':
-    return 0; /* This is A.  */
-  case 'C':
-    return 1; /* This is C.  */
-  case 'G':
-    return 2; /* This is G.  */
-  case 'T':
-    return 3; /* This is T.  */
-  }
-  return 4; /* Everything else.  */
+  out_buf_p_t b = writer.cur;
+  b->len += len;
+  b->seg[b->nSeg - 1].len += len;
 }
 
-static inline void
-findMax(int prev, int *prevV, int transit, int *bPrev, int *bScore)
+/* Mark the end of the output of the records of input file before
+   offset in, see --checkpoint, and hand it to the writer when a
+   checkpoint is due.  */
+static void
+out_mark(unsigned int file, size_t in)
 {
-  int score = prevV[prev] + transit;
-  if (score > *bScore) {
-    *bScore = score;
-    *bPrev = prev;
-  }
+  out_buf_p_t b = writer.cur;
+  b->marked = 1;
+  b->markLen = b->len;
+  b->mark.file = file;
+  b->mark.in = in;
+  if (time(NULL) - writer.flushed >= (time_t) options.ckEvery)
+    out_flush();
 }
 
-static inline void
-findMax0(int prev, int *prevV, int *bPrev, int *bScore)
+static void
+out_write(int dest, const char *s, size_t len)
 {
-  int score = prevV[prev];
-  if (score > *bScore) {
-    *bScore = score;
-    *bPrev = prev;
-  }
+  memcpy(out_room(dest, len), s, len);
+  out_advance(len);
 }
 
 static void
-initIndices(int tsize, int startlen, int stoplen)
-{
-  unsigned int f;
-  iBegin = -1;
-  i5utr = 0;
-  iStart = 1;
-  iCds = iStart + startlen;
-  iStop = iCds + 3;
-  i3utr = iStop + stoplen;
-  for (f = 0; f < 3; f++) {
-    iInsAfter[f] = i3utr + f * tsize + 1;
-    iDelAfter[f] = i3utr + (f + 3) * tsize - f + 1;
-  }
-  for (f = 0; f < 3; f++) {
-    unsigned int f1;
-    for (f1 = 0; f1 < 3; f1++) {
-      if ((f1 + tsize)     % 3 == f)
-	iInsNext[f] = iInsAfter[f1] + tsize - 1;
-      if ((f1 + tsize + 1) % 3 == f)
-	iDelNext[f] = iDelAfter[f1] + tsize - 2;
-    }
+out_printf(int dest, const char *fmt, ...)
+{
+  va_list ap;
+  size_t room = 256;
+  int n;
+  va_start(ap, fmt);
+  n = vsnprintf(out_room(dest, room), room, fmt, ap);
+  va_end(ap);
+  if ((size_t) n >= room) {
+    room = n + 1;
+    va_start(ap, fmt);
+    vsnprintf(out_room(dest, room), room, fmt, ap);
+    va_end(ap);
   }
+  out_advance(n);
 }
 
-#ifdef DEBUG
+/* Write the len chars of s in lines of options.sWidth.  */
 static void
-printIndex(unsigned int index, unsigned int len)
+out_lines(int dest, const char *s, size_t len)
 {
-  char *s = (char *) xmalloc(sizeof(char) * (len + 1));
-  int i;
-  s[len] = 0;
-  for (i = len - 1; i >= 0; i--) {
-    int c = index % 5;
-    index /= 5;
-    switch (c) {
-    case 0:
-      s[i] = 'A';
-      break;
-    case 1:
-      s[i] = 'C';
-      break;
-    case 2:
-      s[i] = 'G';
-      break;
-    case 3:
-      s[i] = 'T';
-      break;
-    default:
-      s[i] = 'N';
-    }
+  size_t width = options.sWidth > 0 ? options.sWidth : len + 1;
+  char *p = out_room(dest, len + len / width + 1);
+  char *q = p;
+  while (len > width) {
+    memcpy(q, s, width);
+    q[width] = '\n';
+    q += width + 1;
+    s += width;
+    len -= width;
   }
-  fputs(s, stderr);
-  free(s);
+  memcpy(q, s, len);
+  q[len] = '\n';
+  out_advance(q + len + 1 - p);
 }
 
-static void
-printInitStatus(unsigned int states, unsigned int seqLen,
-		unsigned int tsize, unsigned int tableSize,
-		unsigned int tindex,
-		unsigned int *insTindex, unsigned int *delTindex)
-{
-  unsigned int f, i;
-  fprintf(stderr, "Begin: %d\n", iBegin);
-  fprintf(stderr, "5'UTR: %d\n", i5utr);
-  fprintf(stderr, "Start: %d\n", iStart);
-  fprintf(stderr, "Stop:  %d\n", iStop);
-  fprintf(stderr, "3'UTR: %d\n", i3utr);
-  for (f = 0; f < 3; f++)
-    fprintf(stderr, "Frame %u: CDS %d, insert after/next %d/%d, delete after/next %d/%d\n",
-	    f, iCds + f, iInsAfter[f], iInsNext[f], iDelAfter[f], iDelNext[f]);
-  fprintf(stderr, "states %u, seq length %u, tsize %u, tableSize %u, tindex ",
-	  states, seqLen, tsize, tableSize);
-  printIndex(tindex, tsize);
-  fprintf(stderr, "\ninsertion indices: ");
-  for (i = 0; i < tsize; i++) {
-    printIndex(insTindex[i], tsize);
-    fprintf(stderr, " ");
-  }
-  fprintf(stderr, "\ndeletion indices: ");
-  for (i = 0; i < tsize - 1; i++) {
-    printIndex(delTindex[i], tsize);
-    fprintf(stderr, " ");
-  }
-  fprintf(stderr, "\n");
+/* Header of the result being written, kept from one result to the
+   next.  */
+static char *outHead;
+static size_t outHeadMax;
+
+/* Copy n chars of the given strand of seq from pos, in lower case, or
+   of s, to q at column *col of lines of width chars.  */
+static char *
+put_wrapped(char *q, const seq_t *seq, int reverse, unsigned int pos,
+	    const char *s, size_t n, size_t *col, size_t width)
+{
+  while (n > 0) {
+    size_t k;
+    if (*col == width) {
+      *q++ = '\n';
+      *col = 0;
+    }
+    k = min(n, width - *col);
+    if (s != NULL) {
+      memcpy(q, s, k);
+      s += k;
+    } else {
+      seq_strand_lower(seq, reverse, pos, k, q);
+      pos += k;
+    }
+    q += k;
+    *col += k;
+    n -= k;
+  }
+  return q;
 }
 
+/* All in one output: the header gets the scores of all results, and the
+   sequence is written in lower case, with the coding sequences of the
+   results above the -b threshold in place.  Only the strand of the best
+   result is written, the minus strand being read through the
+   complement.  */
 static void
-printCurrentStatus(unsigned int p, unsigned char c, unsigned int code,
-		   unsigned int tindex, unsigned int tsize,
-		   unsigned int *insTindex, unsigned int *delTindex,
-		   unsigned int states,
-		   int *currV, int *currTr)
+showAll(col_p_t rc, seq_p_t seq, int maxScore)
 {
-  unsigned int i;
-  fprintf(stderr, "%u:%c-%u: ", p, c, code);
-  printIndex(tindex, tsize);
-  fprintf (stderr, " /");
-  for (i = 0; i < tsize; i++) {
-    fprintf(stderr, " ");
-    printIndex(insTindex[i], tsize);
-  }
-  fprintf(stderr, " /");
-  for (i = 0; i < tsize - 1; i++) {
-    fprintf(stderr, " ");
-    printIndex(delTindex[i], tsize);
-  }
-  fprintf(stderr, "\n");
-  for (i = 0; i < states; i++) {
-    if (currV[i] < INT_MIN / 3)
-      fprintf(stderr, " -inf/%2d", currTr[i]);
-    else
-      fprintf(stderr, "%5d/%2d", currV[i], currTr[i]);
-    if ((i % 10) == 9)
-      fprintf(stderr, "\n");
+  static result_p_t *kept;
+  static unsigned int keptMax;
+  const char *h = es_seq_header(seq);
+  size_t len, total, width, col = 0;
+  unsigned int i, n = 0, last = 0;
+  int reverse = 0, best;
+  char *p, *q;
+  if (options.out == NULL)
+    return;
+  if (keptMax < rc->nb) {
+    keptMax = rc->nb;
+    free(kept);
+    kept = (result_p_t *) xmalloc(keptMax * sizeof(result_p_t));
+  }
+  for (i = 0, best = INT_MIN; i < rc->nb; i++)
+    if (rc->e.r[i]->score > best) {
+      best = rc->e.r[i]->score;
+      reverse = rc->e.r[i]->reverse;
+    }
+  len = 0;
+  while (h[len] && !isspace(h[len]))
+    len += 1;
+  out_write(OUT_NT, h, len);
+  out_write(OUT_NT, " ", 1);
+  total = es_seq_len(seq);
+  for (i = 0; i < rc->nb; i++) {
+    result_p_t r = rc->e.r[i];
+    unsigned int j;
+    out_printf(OUT_NT, "%d ", r->score);
+    if ((double) maxScore * options.both > (double) r->score
+	|| r->reverse != reverse)
+      continue;
+    /* Keep them by start, the traceback found them last first.  */
+    for (j = n++; j > 0 && kept[j - 1]->start > r->start; j--)
+      kept[j] = kept[j - 1];
+    kept[j] = r;
+    total += strlen((char *) r->s);
+  }
+  h += len;
+  len = strlen(h);
+  while (len > 0 && isspace(h[len - 1]))
+    len -= 1;
+  out_write(OUT_NT, h, len);
+  if (reverse)
+    out_write(OUT_NT, "; minus strand", 14);
+  out_write(OUT_NT, "\n", 1);
+  width = options.sWidth > 0 ? options.sWidth : total + 1;
+  p = q = out_room(OUT_NT, total + total / width + 1);
+  for (i = 0; i < n; i++) {
+    result_p_t r = kept[i];
+    if (r->start > last)
+      q = put_wrapped(q, seq, reverse, last, NULL, r->start - last, &col,
+		      width);
+    q = put_wrapped(q, seq, reverse, 0, (char *) r->s,
+		    strlen((char *) r->s), &col, width);
+    last = r->stop + 1;
   }
-  fprintf(stderr, "\n");
+  if (last < es_seq_len(seq))
+    q = put_wrapped(q, seq, reverse, last, NULL, es_seq_len(seq) - last, &col,
+		    width);
+  *q++ = '\n';
+  out_advance(q - p);
 }
-#endif
 
-/* returns frame if <state> is coding, relies on startoffset,
-   startlength, stopoffset and stoplength to be multiples of
-   3, returns -1 if not coding */
-static inline int
-getFrame(int state, int tsize, int startoffset, int stopoffset)
-{
-  int f;
-  int d = state - iStart - startoffset + 1;
-  if (d < 0)
-    return -1;
-  if (state < (iStop + stopoffset))
-    return(d % 3);
-  for (f = 1; f < tsize; f++) {
-    if ((iInsAfter[(12 - f) % 3] + f) == state)
-      return 0;
-    if ((iInsAfter[(13 - f) % 3] + f) == state)
-      return 1;
-    if ((iInsAfter[(14 - f) % 3] + f) == state)
-      return 2;
-    if ((iDelAfter[(14 - f) % 3] + f - 1) == state)
-      return 0;
-    if ((iDelAfter[(15 - f) % 3] + f - 1) == state)
-      return 1;
-    if ((iDelAfter[(16 - f) % 3] + f - 1) == state)
-      return 2;
-  }
-  return -1;
+/* Edit k of r, counting from the start of the forward strand.  */
+static unsigned int
+editAt(const result_t *r, unsigned int k)
+{
+  return r->edits[r->reverse ? r->nEdits - 1 - k : k];
 }
 
-static int
-Compute(seq_p_t seq, col_p_t mc, col_p_t rc, int reverse, int maxScore)
+/* Forward strand position of the edit e of r.  A deletion is given by
+   the nucleotide after which it falls.  */
+static unsigned int
+editPos(const result_t *r, unsigned int e, unsigned int len)
 {
-  matrix_p_t M[MT_COUNT];
-  unsigned int i, code, f, s;
-  unsigned char *p;
-  int iCurr, bPrev, bScore, tmpPrev, tmpScore;
-  unsigned int tableSize = 1;
-  unsigned int tindex;
-  unsigned int *insTindex, *delTindex;
-  unsigned int states, mSize;
-  int *currV, *prevV, *currTr;
-
-  /* Find the right matrices.  */
-  memset(M, 0, sizeof(M));
-  for (i = 0; i < mc->nb; i ++) {
-    if (seq->GC_pct >= mc->e.m[i]->CGmin
-	&& seq->GC_pct <= mc->e.m[i]->CGmax
-	&& M[mc->e.m[i]->matType] == NULL)
-      M[mc->e.m[i]->matType] = mc->e.m[i];
-  }
-  for (i = 0; i < MT_COUNT; i++)
-    if (M[i] == NULL)
-      fatal("We have no %d matrix for %.2f GC in:\n %s",
-	    i, seq->GC_pct, seq->header);
-  /* initialize some more parameters */
-  insTindex = (unsigned int *) xmalloc(sizeof(unsigned int)
-				       * M[MT_CODING]->order);
-  delTindex = (unsigned int *) xmalloc(sizeof(unsigned int)
-				       * (M[MT_CODING]->order - 1));
-  /* allocate tables and compute the state indices  */
-  states = 2 + M[MT_START]->frames
-	  + M[MT_STOP]->frames + 6 * M[MT_CODING]->order;
-  mSize = sizeof(int) * seq->len * states;
-  if (maxSize < mSize) {
-    maxSize = mSize;
-    V  = (int *) xrealloc(V,  maxSize);
-    tr = (int *) xrealloc(tr, maxSize);
-  }
-  currV  = V; currTr = tr;
-  /* size of score tables per frame */
-  for (i = 0; i < M[MT_CODING]->order; i++)
-    tableSize *= 5;
-  /* tindex will point to the position representing the last
-   * M[MT_CODING]->order chars on seq */
-  /* tindex now represents all N's */
-  tindex = tableSize - 1;
-  for (i = 0; i < M[MT_CODING]->order - 1; i++)
-    insTindex[i] = delTindex[i] = tindex;
-  insTindex[i] = tindex;
-  initIndices(M[MT_CODING]->order, M[MT_START]->frames, M[MT_STOP]->frames);
-#ifdef DEBUG
-  printInitStatus(states, seq->len, M[MT_CODING]->order, tableSize,
-		  tindex, insTindex, delTindex);
-#endif
-  /* fill in the Viterbi and traceback tables, initialize for first char on seq */
-  code = GetCode(seq->seq[0]);
-  tindex = (5 * tindex + code) % tableSize;
-  currV[i5utr] = options.ts5uPen + M[MT_UNTRANSLATED]->m[0][tindex];
-  for (f = 0; f < M[MT_START]->frames; f++)
-    currV[iStart+f] = options.min + M[MT_START]->m[f][code];
-  for (f = 0; f <  3; f++)
-    currV[iCds + f] = options.tscPen + M[MT_CODING]->m[f][tindex];
-  for (f = 0; f < M[MT_STOP]->frames; f++)
-    currV[iStop + f] = options.min + M[MT_STOP]->m[f][code];
-  currV[i3utr] = options.ts3uPen + M[MT_UNTRANSLATED]->m[0][tindex];
-  for (s = i3utr + 1; s < states; s++)
-    currV[s] = INT_MIN / 2;
-  for (s = 0; s < states; s++)
-    currTr[s] = iBegin;
-#ifdef DEBUG
-  printCurrentStatus(0, seq->seq[0], code, tindex, M[MT_CODING]->order,
-		     insTindex, delTindex, states, V, tr);
-#endif
-  /* fill in the Viterbi and traceback tables, main part */
-  for (p = seq->seq + 1; *p; p++) {
-    prevV = currV;
-    currV += states;
-    currTr += states;
-    /* update index variables */
-    code = GetCode(*p);
-    for (i = M[MT_CODING]->order - 1; i > 0; i--)
-      insTindex[i] = (5 * insTindex[i - 1] + code) % tableSize;
-    if (M[MT_CODING]->order > 2)
-      for (i = M[MT_CODING]->order - 2; i > 0; i--)
-	delTindex[i] = (5 * delTindex[i - 1] + code) % tableSize;
-    insTindex[0] = tindex;
-    delTindex[0] = (25 * tindex + 20 + code) % tableSize;
-    tindex = (5 * tindex + code) % tableSize;
-    /* consider current nucleotide in 5'UTR */
-    /* transitions UTR->UTR and CDS->CDS are presumed zero */
-    currV[i5utr]  = prevV[i5utr] + M[MT_UNTRANSLATED]->m[0][tindex];
-    currTr[i5utr] = i5utr;
-    /* consider current nucleotide in start profile */
-    currV[iStart]  = prevV[i5utr] + options.t5ucPen + M[MT_START]->m[0][code];
-    currTr[iStart] = i5utr;
-    iCurr = iStart;
-    bPrev = iStart - 1;
-    for (f = 1; f < M[MT_START]->frames; f++) {
-      iCurr += 1;
-      bPrev += 1;
-      currV[iCurr] = prevV[bPrev] + M[MT_START]->m[f][code];
-      currTr[iCurr] = bPrev;
-    }
-    /* consider current nucleotide in CDS */
-    iCurr = iCds;
-    bPrev = iCds - 1;
-    bScore = prevV[bPrev];
-    findMax(i5utr, prevV, options.min, &bPrev, &bScore);
-    findMax0(iCurr + 2, prevV, &bPrev, &bScore);
-    findMax0(iInsNext[0], prevV, &bPrev, &bScore);
-    findMax0(iDelNext[0], prevV, &bPrev, &bScore);
-    currV[iCurr] = bScore + M[MT_CODING]->m[0][tindex];
-    currTr[iCurr] = bPrev;
-    for (f = 1; f < 3; f++) {
-      iCurr += 1;
-      bPrev = iCurr - 1;
-      bScore = prevV[bPrev];
-      findMax0(iInsNext[f], prevV, &bPrev, &bScore);
-      findMax0(iDelNext[f], prevV, &bPrev, &bScore);
-      currV[iCurr] = bScore + M[MT_CODING]->m[f][tindex];
-      currTr[iCurr] = bPrev;
-    }
-    /* consider current nucleotide in stop profile */
-    bPrev = INT_MIN;
-    bScore = INT_MIN;
-    for (f = M[MT_START]->offset + 2; f < M[MT_START]->frames; f += 3)
-      findMax(iStart + f, prevV, options.min, &bPrev, &bScore);
-    for (f = 0; f < M[MT_CODING]->order; f++)
-      findMax(iInsAfter[(14 - f) % 3] + f, prevV, options.min, &bPrev, &bScore);
-    for (f = 0; f < M[MT_CODING]->order - 1; f++)
-      findMax(iDelAfter[(15 - f) % 3] + f, prevV, options.min, &bPrev, &bScore);
-    tmpPrev = bPrev;
-    tmpScore = bScore;
-    findMax(iCds + 2, prevV, options.tc3uPen, &bPrev, &bScore);
-    currV[iStop] = bScore + M[MT_STOP]->m[0][code];
-    currTr[iStop] = bPrev;
-    iCurr = iStop;
-    bPrev = iStop - 1;
-    for (f = 1; f < M[MT_STOP]->frames; f++) {
-      iCurr += 1;
-      bPrev += 1;
-      currV[iCurr] = prevV[bPrev] + M[MT_STOP]->m[f][code];
-      currTr[iCurr] = bPrev;
-    }
-    /* consider current nucleotide in 3' UTR */
-    bPrev = INT_MIN;
-    bScore = INT_MIN;
-    findMax0(i3utr - 1, prevV, &bPrev, &bScore);
-    findMax0(i3utr, prevV, &bPrev, &bScore);
-    findMax(iCds+2, prevV, options.min, &bPrev, &bScore);
-    currV[i3utr]  = bScore + M[MT_UNTRANSLATED]->m[0][tindex];
-    currTr[i3utr] = bPrev;
-    /* consider current nucleotide in CDS after insertion */
-    for (f = 0; f < 3; f++) {
-      iCurr = iInsAfter[f];
-      bPrev = iCds + f;
-      currV[iCurr] = prevV[bPrev] + options.iPen;
-      currTr[iCurr] = bPrev;
-      iCurr = iInsAfter[f];
-      bPrev = iCurr - 1;
-      for (i = 1; i < M[MT_CODING]->order; i++) {
-	iCurr += 1;
-	bPrev += 1;
-	currV[iCurr] = prevV[bPrev] + M[MT_CODING]->m[(i + f) % 3][insTindex[i]];
-	currTr[iCurr] = bPrev;
-      }
-    }
-    /* consider current nucleotide in CDS after deletion */
-    for (f = 0; f < 3; f++) {
-      iCurr = iDelAfter[f];
-      bPrev = iCds + f;
-      currV[iCurr] = prevV[bPrev] + options.dPen
-		    + M[MT_CODING]->m[(f + 2) % 3][delTindex[0]];
-      currTr[iCurr] = bPrev;
-      iCurr = iDelAfter[f];
-      bPrev = iCurr - 1;
-      for (i = 1; i < M[MT_CODING]->order - 1; i++) {
-	iCurr += 1;
-	bPrev += 1;
-	currV[iCurr] = prevV[bPrev] + M[MT_CODING]->m[(i + f + 2) % 3][delTindex[i]];
-	currTr[iCurr] = bPrev;
-      }
-    }
-#ifdef DEBUG
-    printCurrentStatus(p - seq->seq, *p, code, tindex, M[MT_CODING]->order,
-		       insTindex, delTindex, states, currV, currTr);
-#endif
-  }
-  /* fill in the Viterbi and traceback tables, terminate and find best */
-  bPrev = i5utr;
-  bScore = currV[bPrev] + options.t5uePen;
-  for (f = 0; f < M[MT_START]->frames; f++)
-    findMax(iStart+f, currV, options.min, &bPrev, &bScore);
-  for (f = 0; f < 3; f++) {
-    findMax(iCds+f, currV, options.tcePen, &bPrev, &bScore);
-    for (i = 0; i < M[MT_CODING]->order; i++)
-      findMax(iInsAfter[f] + i, currV, options.tcePen, &bPrev, &bScore);
-    for (i = 0; i < M[MT_CODING]->order - 1; i++)
-      findMax(iDelAfter[f] + i, currV, options.tcePen, &bPrev, &bScore);
-  }
-  for (f = 0; f < M[MT_STOP]->frames; f++)
-    findMax(iStop+f, currV, options.min, &bPrev, &bScore);
-  findMax(i3utr, currV, options.t3uePen, &bPrev, &bScore);
-#ifdef DEBUG
-  fprintf(stderr, "finished to fill Viterbi matrix, best score %d in state %d\n",
-	  bScore, bPrev);
-#endif
-  /* traceback and generate coding sequences starting from bPrev (confidence bScore) */
-  iCurr = bPrev;
-  p -= 1;
-  while(iCurr != iBegin) {
-    int iOld = -1, rStart, rStop;
-    unsigned char *r, *q;
-    /* skip non coding */
-    while((iBegin < iCurr
-	   && iCurr < iStart + M[MT_START]->offset - 1)
-	  || (iStop + M[MT_STOP]->offset - 1 < iCurr
-	      && iCurr < iInsAfter[0])) {
-#ifdef DEBUG
-      fprintf(stderr, "trace back non-coding: state %d position %4d(%c)\n",
-	      iCurr, p - seq->seq, *p);
-#endif
-      iCurr = currTr[iCurr];
-      currTr -= states;
-      p -= 1;
-    }
-    /* handle coding */
-    if (iCurr != iBegin) {
-      unsigned char *res = (unsigned char *) xmalloc(sizeof(unsigned char)
-						     * 2 * seq->len);
-      int rScore = V[(p - seq->seq) * states + iCurr];
-      r = res;
-      rStop = (p - seq->seq);
-      if (getFrame(iCurr, M[MT_CODING]->order,
-		   M[MT_START]->offset, M[MT_STOP]->offset) == 0) {
-	*r++ = 'X';
-	*r++ = 'X';
-      }
-      if (getFrame(iCurr, M[MT_CODING]->order,
-		   M[MT_START]->offset, M[MT_STOP]->offset) == 1)
-	*r++ = 'X';
-      while((iStart + M[MT_START]->offset - 1 <= iCurr
-	     && iCurr <= iStop + M[MT_STOP]->offset - 1)
-	    || iInsAfter[0] <= iCurr) {
-	int done = 0;
-	for (f = 0; f < 3; f++) {
-	  if (iCurr == iInsAfter[f]) {
-	    *r++ = tolower(*p);
-	    done = 1;
-	  }
-	  if (iCurr == iDelAfter[f]) {
-	    *r++ = toupper(*p);
-	    *r++ = 'X';
-	    done = 1;
-	  }
-	}
-	if (done == 0)
-	  *r++ = toupper(*p);
-	/* remove stop-profile penalty from coding score */
-	if (iCurr == iCds + 2 && iOld == iStop)
-	  rScore -= options.tc3uPen;
-#ifdef DEBUG
-      fprintf(stderr, "trace back     coding: state %2d(%2d) position %4d(%c)\n",
-	      iCurr, getFrame(iCurr, M[MT_CODING]->order,
-	      M[MT_START]->offset, M[MT_STOP]->offset), p-seq->seq, *(r-1));
-#endif
-	iOld = iCurr;
-	iCurr = currTr[iCurr];
-	currTr -= states;
-	p -= 1;
-      }
-      rStart = p - seq->seq + 1;
-      if (p >= seq->seq)
-	rScore -= V[(p - seq->seq) * states + iCurr];
-      if (rScore > maxScore)
-	maxScore = rScore;
-      if (getFrame(iOld, M[MT_CODING]->order,
-		   M[MT_START]->offset, M[MT_STOP]->offset) == 1)
-	*r++ = 'X';
-      if (getFrame(iOld, M[MT_CODING]->order,
-		   M[MT_START]->offset, M[MT_STOP]->offset) == 2) {
-	*r++='X';
-	*r++='X';
-      }
-      *r-- = 0;
-      /* reverse the array and add to the result-array */
-      q = res;
-      while (q < r) {
-	unsigned char c = *r;
-	*r-- = *q;
-	*q++ = c;
-      }
-#ifdef DEBUG
-      fprintf(stderr, "found coding %s, add to results, state %d \n",
-	      res, iCurr);
-#endif
-      if (rStop - rStart >= options.minLen) {
-	result_p_t r = (result_p_t) xmalloc(sizeof(result_t));
-	r->score = rScore;
-	r->start = rStart;
-	r->stop = rStop;
-	r->reverse = reverse;
-	r->s = res;
-	add_col_elt(rc, r, 8);
-      } else
-	free(res);
-    }
-  }
-  /* clean up */
-  free(insTindex);
-  free(delTindex);
-  return maxScore;
+  unsigned int pos = e & ~EDIT_DEL;
+  if (r->reverse)
+    pos = len - 1 - pos;
+  if (e & EDIT_DEL)
+    pos = r->reverse ? pos : pos - 1;
+  return pos;
 }
 
-static void
-LoadMatrix(const char *fName, col_p_t mc)
-{
-  read_buf_t rb;
-  char *buf;
-  int fd = open(fName, O_RDONLY);
-  if (fd == -1)
-    fatal("Could not open file %s: %s(%d)\n", fName, strerror(errno), errno);
-  init_col(mc, 16);
-  init_buf(&rb);
-  buf = read_line_buf(&rb, fd);
-  while (rb.lc > 0) {
-    if (strncmp(buf, "FORMAT: ", 8) == 0) {
-      matrix_p_t m = (matrix_p_t) xmalloc(sizeof(matrix_t));
-      char name[256], fType[256], mType[256];
-      int res;
-      unsigned int size = 256;
-      signed char *data = (signed char *) xmalloc(sizeof(signed char) * size);
-      unsigned int nElt = 0;
-      res = sscanf(buf,
-		   "FORMAT: %255s %255s %255s %u %u %d s C+G: %lf %lf",
-		   name, fType, mType, &m->order, &m->frames, &m->offset,
-		   &m->CGmin, &m->CGmax);
-      if (m->CGmin < 0.0)
-	m->CGmin = 0.0;
-      if (m->CGmin > 0.0)
-	m->CGmin += options.percent;
-      m->CGmax += options.percent;
-      if (m->CGmax > 100.0)
-	m->CGmax = 100.0;
-      if (res != 8 || (buf = read_line_buf(&rb, fd)) == NULL || rb.lc == 0)
-	fatal("Bad data header format in file %s, near %s (%d)\n",
-	      fName, name, res);
-      m->name = strdup(name);
-      m->kind = strdup(mType);
-      m->matType = MT_UNKNOWN;
-      if (strncmp(fType, "CODING", 6) == 0)
-	m->matType = MT_CODING;
-      if (strncmp(fType, "UNTRANSLATED", 12) == 0)
-	m->matType = MT_UNTRANSLATED;
-      if (strncmp(fType, "START", 5) == 0)
-	m->matType = MT_START;
-      if (strncmp(fType, "STOP", 4) == 0)
-	m->matType = MT_STOP;
-      while (buf[0] == '-' || isdigit(buf[0])) {
-	int a, c, g, t;
-	res = sscanf(buf, "%d %d %d %d", &a, &c, &g, &t);
-	if (res != 4 || (buf = read_line_buf(&rb, fd)) == NULL)
-	  fatal("Bad data format in file %s, near %s (%d)\n",
-		fName, name, res);
-	if (nElt + 4 > size) {
-	  size += 256;
-	  data = (signed char *) xrealloc(data, sizeof(signed char) * size);
-	}
-	data[nElt++] = a;
-	data[nElt++] = c;
-	data[nElt++] = g;
-	data[nElt++] = t;
-      }
-      CreateMatrix(m, data, nElt);
-      add_col_elt(mc, m, 16);
-      free(data);
-    } else if ((buf = read_line_buf(&rb, fd)) == NULL)
-      fatal("Probable bug in read_line_buf while reading %s\n", fName);
+/* Comma separated 1-based positions of the insertions, or of the
+   deletions, of r, after prefix if there are any.  Returns their
+   number.  */
+static unsigned int
+out_edits(const result_t *r, unsigned int len, int del, const char *prefix)
+{
+  const char *sep = prefix;
+  unsigned int k, n = 0;
+  for (k = 0; k < r->nEdits; k++) {
+    unsigned int e = editAt(r, k);
+    if (((e & EDIT_DEL) != 0) == del) {
+      out_printf(OUT_NT, "%s%u", sep, editPos(r, e, len) + 1);
+      sep = ",";
+      n += 1;
+    }
   }
-  close(fd);
-  free_buf(&rb);
+  return n;
 }
 
+/* Write the n chars of s as a GFF3 seqid, or attribute value if attr,
+   escaping the others as %XX.  */
 static void
-remove_lc(unsigned char *s)
+out_gff(const char *s, size_t n, int attr)
 {
-  unsigned char *t = s;
-  while (*s) {
-    if (isupper(*s))
-      *t++ = *s;
-    s += 1;
+  char *p = out_room(OUT_NT, 3 * n);
+  char *q = p;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    unsigned char c = s[i];
+    if (attr ? c >= 0x20 && c != 0x7f && strchr(";=&,%", c) == NULL
+	: isalnum(c) || strchr(".:^*$@!+_?-|", c) != NULL)
+      *q++ = c;
+    else {
+      *q++ = '%';
+      *q++ = "0123456789ABCDEF"[c >> 4];
+      *q++ = "0123456789ABCDEF"[c & 15];
+    }
   }
-  *t = 0;
+  out_advance(q - p);
 }
 
-static char *
-na2aa(unsigned char *s)
-{
-  static char *CABC = "KNKNTTTTRSRSIIMI"  /* AAA AAC ... ATT */
-		      "QHQHPPPPRRRRLLLL"  /* CAA CAC ... CTT */
-		      "EDEDAAAAGGGGVVVV"  /* GAA GAC ... GTT */
-		      "OYOYSSSSOCWCLFLF"; /* TAA TAC ... TTT */
-  static char *CNBC = "XTXXXPRLXAGVXSXX"; /* AAN ACN ... TTN */
-  char *res = xmalloc(sizeof(char) * (strlen((char *) s) / 3 + 2));
-  char *cur = res;
-
-  while (*s) {
-    int idx = 0;
-    /* Check first nt.  */
-    switch (*s) {
-    case 'A':
-      break;
-    case 'C':
-      idx = 1;
-      break;
-    case 'G':
-      idx = 2;
-      break;
-    case 'T':
-      idx = 3;
-      break;
-    default:
-      idx = -1;
-    }
-    s += 1;
-    if (*s == 0) {
-      *cur++ = 'X';
-      break;
-    }
-    if (idx == -1) {
-      *cur++ = 'X';
-      s += 1;
-      if (*s == 0)
-	break;
-      s += 1;
-      continue;
-    }
-    idx <<= 2;
-    /* Check second nt.  */
-    switch (*s) {
-    case 'A':
-      break;
-    case 'C':
-      idx += 1;
-      break;
-    case 'G':
-      idx += 2;
-      break;
-    case 'T':
-      idx += 3;
-      break;
-    default:
-      idx = -1;
+/* Count the BED blocks of r, between its insertions, from start to
+   stop, or write their sizes if what is 0, or their starts if 1.  */
+static unsigned int
+bedBlocks(const result_t *r, unsigned int len, unsigned int start,
+	  unsigned int stop, int what)
+{
+  unsigned int k, n = 0, pos = start;
+  for (k = 0; k <= r->nEdits; k++) {
+    unsigned int x = stop + 1;
+    if (k < r->nEdits) {
+      unsigned int e = editAt(r, k);
+      if (e & EDIT_DEL)
+	continue;
+      x = editPos(r, e, len);
     }
-    s += 1;
-    if (*s == 0) {
-      if (idx == -1)
-	*cur++ = 'X';
-      else
-	*cur++ = CNBC[idx];
-      break;
+    if (x > pos) {
+      if (what == 0)
+	out_printf(OUT_NT, "%u,", x - pos);
+      else if (what == 1)
+	out_printf(OUT_NT, "%u,", pos - start);
+      n += 1;
     }
-    if (idx == -1) {
-      *cur++ = 'X';
-      s += 1;
+    pos = x + 1;
+  }
+  return n;
+}
+
+/* One line per result, on the forward strand, without sequences.  BED
+   leaves the insertions out of its blocks, and scales the scores to the
+   0 to 1000 it allows, 1000 being maxScore.  */
+static void
+showCoords(col_p_t rc, seq_p_t seq, int maxScore)
+{
+  const char *id = es_seq_header(seq) + 1;
+  unsigned int i, idLen = 0;
+  if (options.out == NULL)
+    return;
+  while (id[idLen] && !isspace(id[idLen]))
+    idLen += 1;
+  for (i = 0; i < rc->nb; i++) {
+    result_p_t r = rc->e.r[i];
+    unsigned int start = r->start, stop = r->stop;
+    char strand = r->reverse ? '-' : '+';
+    if ((double) maxScore * options.both > (double) r->score)
       continue;
+    if (r->reverse) {
+      start = es_seq_len(seq) - 1 - r->stop;
+      stop = es_seq_len(seq) - 1 - r->start;
     }
-    idx <<= 2;
-    /* Check third nt.  */
-    switch (*s) {
-    case 'A':
+    switch (options.format) {
+    case FMT_GFF3:
+      out_gff(id, idLen, 0);
+      out_printf(OUT_NT, "\tESTScan\tCDS\t%u\t%u\t%d\t%c\t%d\tID=",
+		 start + 1, stop + 1, r->score, strand, r->phase);
+      out_gff(id, idLen, 1);
+      out_printf(OUT_NT, ".cds%u", i + 1);
+      out_edits(r, es_seq_len(seq), 0, ";insertions=");
+      out_edits(r, es_seq_len(seq), 1, ";deletions=");
+      out_write(OUT_NT, "\n", 1);
       break;
-    case 'C':
-      idx += 1;
-      break;
-    case 'G':
-      idx += 2;
-      break;
-    case 'T':
-      idx += 3;
+    case FMT_BED:
+      out_printf(OUT_NT, "%.*s\t%u\t%u\t%.*s.cds%u\t%d\t%c\t%u\t%u\t0\t%u\t",
+		 idLen, id, start, stop + 1, idLen, id, i + 1,
+		 maxScore > 0 && r->score > 0
+		 ? (int) min(1000.0 * r->score / maxScore, 1000.0) : 0,
+		 strand, start, stop + 1,
+		 bedBlocks(r, es_seq_len(seq), start, stop, -1));
+      bedBlocks(r, es_seq_len(seq), start, stop, 0);
+      out_write(OUT_NT, "\t", 1);
+      bedBlocks(r, es_seq_len(seq), start, stop, 1);
+      out_write(OUT_NT, "\n", 1);
       break;
     default:
-      *cur++ = CNBC[idx >> 2];
-      idx = -1;
+      out_printf(OUT_NT, "%.*s\t%u\t%u\t%c\t%d\t%d\t", idLen, id,
+		 start + 1, stop + 1, strand, r->score, r->phase);
+      if (out_edits(r, es_seq_len(seq), 0, "") == 0)
+	out_write(OUT_NT, ".", 1);
+      out_write(OUT_NT, "\t", 1);
+      if (out_edits(r, es_seq_len(seq), 1, "") == 0)
+	out_write(OUT_NT, ".", 1);
+      out_write(OUT_NT, "\n", 1);
     }
-    if (idx != -1)
-      *cur++ = CABC[idx];
-    s += 1;
   }
-  *cur = 0;
-  return res;
+  if (writer.cur->len >= OUT_BUF_SIZE)
+    out_flush();
 }
 
 static void
-showResults(col_p_t rc, seq_p_t seq, unsigned char *rSeq, int maxScore)
+showResults(col_p_t rc, seq_p_t seq, int maxScore)
 {
   unsigned int i;
   unsigned int cnt = 0;
@@ -1284,54 +1031,39 @@ showResults(col_p_t rc, seq_p_t seq, unsigned char *rSeq, int maxScore)
 	break;
       }
     i = 0;
-    while (!isspace(seq->header[i]))
+    while (!isspace(es_seq_header(seq)[i]))
       i += 1;
     if (r != NULL)
-      fprintf(options.out, "%.*s %d %u %u %u %c\n", i, seq->header,
-	      r->score, r->start + 1, r->stop + 1, seq->len,
-	      r->reverse ? '-' : '+');
+      out_printf(OUT_NT, "%.*s %d %u %u %u %c\n", i, es_seq_header(seq),
+		 r->score, r->start + 1, r->stop + 1, es_seq_len(seq),
+		 r->reverse ? '-' : '+');
     else
-      fprintf(options.out, "%.*s %d\n", i, seq->header, maxScore);
+      out_printf(OUT_NT, "%.*s %d\n", i, es_seq_header(seq), maxScore);
+    if (writer.cur->len >= OUT_BUF_SIZE)
+      out_flush();
     return;
   }
   if (options.all != 0) {
-    fprintf(stderr, "Sorry, options.all is unimplemented yet...\n");
-/*	my $scores = "";
-	my $outSeq = "";
-	my $lastPos = 0;
-	foreach my $r (@$rres) {
-	    my $curScore = $$r[0];
-	    $scores .= $curScore . " ";
-	    if ($theRealMax * $main::both > $curScore) { next; }
-	    if ($$r[1] > $lastPos) {
-		my $s = substr($seq->{_seq}, $lastPos, $$r[1] - $lastPos);
-		$s =~ tr/A-Z/a-z/;
-		$outSeq .= $s;
-	    }
-	    $outSeq .= $$r[3];
-	    $lastPos = $$r[2] + 1;
-	}
-	if ($lastPos < $seq->seqLength) {
-	    my $s = substr($seq->{_seq}, $lastPos);
-	    $s =~ tr/A-Z/a-z/;
-	    $outSeq .= $s;
-	}
-	my $head = $seq->seqHead;
-	$head =~ s/^(\S+)/$1 $scores/;
-	print $main::out "$head\n";
-	$outSeq =~ s/(.{$main::sWidth})/$1\n/g;
-	$outSeq =~ s/\s+$//; # remove a trailing newline, since we add one below.
-	print $main::out "$outSeq\n"; */
+    showAll(rc, seq, maxScore);
+    return;
+  }
+  if (options.format != FMT_FASTA) {
+    showCoords(rc, seq, maxScore);
     return;
   }
   for (i = 0; i < rc->nb; i++) {
     result_p_t r = rc->e.r[i];
-    char *h = seq->header;
+    const char *h = es_seq_header(seq);
     size_t len = strlen(h);
     char *buf, *ptr;
     if ((double) maxScore * options.both > (double) r->score)
       continue;
-    buf = (char *) xmalloc((len + 256) * sizeof(char));
+    if (outHeadMax < len + 256) {
+      outHeadMax = len + 256;
+      free(outHead);
+      outHead = (char *) xmalloc(outHeadMax * sizeof(char));
+    }
+    buf = outHead;
     ptr = buf;
     while (*h && *h != '|' && !isspace(*h))
       *ptr++ = *h++;
@@ -1361,95 +1093,997 @@ showResults(col_p_t rc, seq_p_t seq, unsigned char *rSeq, int maxScore)
       }
     }
     if (options.transl != NULL) {
-      char *ps;
-      remove_lc(r->s);
-      ps = na2aa(r->s);
       len = strlen(buf);
       while (isspace(buf[len - 1]))
 	len -= 1;
-      fprintf(options.transl, "%.*s; translated\n", (unsigned int) len, buf);
-      len = strlen(ps);
-      ptr = ps;
-      /* remove trailing stop codon(s).  */
-      while (len > 0 && ps[len - 1] == 'O') {
-	len -= 1;
-	ps[len] = 0;
-      }
-      /* translate intermediate stop codons by X.  */
-      while (*ptr) {
-	if (*ptr == 'O')
-	  *ptr = 'X';
-	ptr += 1;
-      }
-      ptr = ps;
-      while (len > options.sWidth) {
-	fprintf(options.transl, "%.*s\n", options.sWidth, ptr);
-	len -= options.sWidth;
-	ptr += options.sWidth;
-      }
-      fprintf(options.transl, "%s\n", ptr);
-      free(ps);
+      out_write(OUT_AA, buf, len);
+      out_write(OUT_AA, "; translated\n", 13);
+      out_lines(OUT_AA, r->aa, strlen(r->aa));
     }
     if (options.out != NULL) {
-      fputs(buf, options.out);
-      if (options.no_del != 0)
-	remove_lc(r->s);
-      len = strlen((char *) r->s);
-      ptr = (char *) r->s;
-      while (len > options.sWidth) {
-	fprintf(options.out, "%.*s\n", options.sWidth, ptr);
-	len -= options.sWidth;
-	ptr += options.sWidth;
-      }
-      fprintf(options.out, "%s\n", ptr);
+      out_write(OUT_NT, buf, strlen(buf));
+      out_lines(OUT_NT, (char *) r->s, strlen((char *) r->s));
     }
-    free(buf);
   }
+  if (writer.cur->len >= OUT_BUF_SIZE)
+    out_flush();
 }
 
-static void
-process_file(const char *fName, col_p_t mc)
-{
-  seq_t seq;
+/* Records handed to the worker threads.  The reader swaps its sequence
+   buffers with those of a free slot, so that no copy is needed.  */
+typedef struct _job_t {
+  seq_p_t seq;
   col_t rc;
-  init_col(&rc, 8);
-  init_seq(fName, &seq);
-  while (get_next_seq(&seq) == 0) {
-    unsigned int i;
-    int maxScore = INT_MIN;
-    unsigned char *rSeq = NULL;
-    if (seq.len == 0)
-      continue;
-    maxScore = Compute(&seq, mc, &rc, 0, maxScore);
-    if (options.single == 0) {
-      if (options.all)
-	rSeq = (unsigned char *) strdup((char *) seq.seq);
-      seq_revcomp_inplace(&seq);
-      maxScore = Compute(&seq, mc, &rc, 1, maxScore);
-      if (options.all) {
-	unsigned char *tem = rSeq;
-	rSeq = seq.seq;
-	seq.seq = tem;
-      }
-    }
-    showResults(&rc, &seq, rSeq, maxScore);
-    for (i = 0; i < rc.nb; i++) {
-      result_p_t r = rc.e.r[i];
-      free(r->s);
-      free(r);
-    }
-    rc.nb = 0;
-    free(rSeq);
-  }
-  free_seq(&seq);
-  free_col(&rc);
-/*
-    my $bigMax = ESTScan::Compute($seq->{_seq}, $main::iPen, $main::dPen, $main::min,
-				  $main::maxOnly == 0 ? \@res : undef, $matIndex,
-				  $utrMatIndex, $startMatIndex, $stopMatIndex,
-				  $main::minLen);
-    my $result_nr = -1;
-    if ($main::single != 0) {
+  arena_t arena;
+  int maxScore;
+  int state;
+  /* Offset of the next record in the input.  */
+  size_t end;
+} job_t, *job_p_t;
+
+/* Sequences at least this long have their reverse strand scanned by a
+   second thread, with a scanner of its own.  Both strands read the same
+   buffer.  */
+#define STRAND_THREAD_LEN 65536
+
+typedef int (*compute_t)(scanner_p_t, seq_p_t, col_p_t, int, int *);
+
+/* Reverse strand scan handed to the second thread, whose results are
+   copied to the arena of the record once it is done.  */
+typedef struct _strand_t {
+  compute_t compute;
+  scanner_p_t sc;
+  seq_p_t seq;
+  col_t rc;
+  arena_t arena;
+  int maxScore;
+} strand_t, *strand_p_t;
+
+static void *
+scan_reverse(void *arg)
+{
+  strand_p_t st = (strand_p_t) arg;
+  st->maxScore = INT_MIN;
+  if (st->compute(st->sc, st->seq, &st->rc, 1, &st->maxScore) != 0)
+    fatal("%s", es_error());
+  return NULL;
+}
+
+/* Whether seq is scanned as a stream, see -L.  Those left in the input
+   must be.  */
+static int
+streamed(const seq_t *seq)
+{
+  return es_seq_data(seq) == NULL
+	 || (options.streamMin > 0 && es_seq_len(seq) >= options.streamMin);
+}
+
+/* Whether each strand of seq is scanned by several threads, see -G.  */
+static int
+parallel(const seq_t *seq)
+{
+  return options.parMin > 0 && es_seq_len(seq) >= options.parMin
+	 && !options.maxOnly && !streamed(seq);
+}
+
+/* Scanners of each thread scanning records: two, one per strand, or as
+   many as -j for -G.  */
+static unsigned int
+scanner_count(void)
+{
+  if (options.parMin > 0 && options.threads > 2)
+    return options.threads;
+  return 2;
+}
+
+static scanner_p_t *
+new_scanners(col_p_t mc)
+{
+  unsigned int n = scanner_count(), i;
+  scanner_p_t *sc = (scanner_p_t *) xmalloc(n * sizeof(scanner_p_t));
+  for (i = 0; i < n; i++)
+    if ((sc[i] = es_scanner_new(mc, &options.p)) == NULL)
+      fatal("%s", es_error());
+  return sc;
+}
+
+static void
+free_scanners(scanner_p_t *sc)
+{
+  unsigned int n = scanner_count(), i;
+  for (i = 0; i < n; i++)
+    es_scanner_free(sc[i]);
+  free(sc);
+}
+
+/* Scan both strands of seq, or only the forward one with -S.  sc[1] is
+   used for the reverse strand of long sequences, and all the scanners
+   for each strand in turn with -G.  */
+static int
+scan_seq(scanner_p_t *sc, seq_p_t seq, col_p_t rc)
+{
+  compute_t compute = Compute;
+  int maxScore = INT_MIN;
+  if (parallel(seq)) {
+    if (ComputeParallel(sc, scanner_count(), seq, rc, 0, &maxScore) != 0
+	|| (options.single == 0
+	    && ComputeParallel(sc, scanner_count(), seq, rc, 1, &maxScore)
+	       != 0))
+      fatal("%s", es_error());
+    return maxScore;
+  }
+  /* Max only output needs neither the traceback nor the sequences.  */
+  if (options.maxOnly)
+    compute = ComputeMax;
+  else if (streamed(seq))
+    compute = ComputeStream;
+  if (options.single == 0 && es_seq_len(seq) >= STRAND_THREAD_LEN) {
+    strand_t st;
+    pthread_t tid;
+    st.compute = compute;
+    st.sc = sc[1];
+    st.seq = seq;
+    if (init_col(&st.rc, 8) != 0)
+      fatal("%s", es_error());
+    init_arena(&st.arena);
+    st.rc.arena = &st.arena;
+    if (pthread_create(&tid, NULL, scan_reverse, &st) == 0) {
+      unsigned int i;
+      if (compute(sc[0], seq, rc, 0, &maxScore) != 0)
+	fatal("%s", es_error());
+      pthread_join(tid, NULL);
+      for (i = 0; i < st.rc.nb; i++)
+	if (copy_result(rc, st.rc.e.r[i]) != 0)
+	  fatal("%s", es_error());
+      free_col(&st.rc);
+      free_arena(&st.arena);
+      return max(maxScore, st.maxScore);
+    }
+    free_col(&st.rc);
+  }
+  if (compute(sc[0], seq, rc, 0, &maxScore) != 0
+      || (options.single == 0 && compute(sc[0], seq, rc, 1, &maxScore) != 0))
+    fatal("%s", es_error());
+  return maxScore;
+}
+
+/* Number of records handed together to ComputeBatch, which groups
+   them by matrices and length to fill its lanes.  */
+#define BATCH_RECORDS (8 * BATCH_LANES)
+
+/* Results of the sequences already scanned, reused for their duplicates
+   and, when both strands are scanned, for their reverse complements,
+   see -c.  An entry is found by the hash of the sequence, or the lesser
+   of the hashes of both strands, and its matrices, and is checked
+   against its bytes.  The least recently used ones are dropped to keep
+   within the limit.  */
+typedef struct _cache_ent_t {
+  struct _cache_ent_t *next;
+  struct _cache_ent_t *older;
+  struct _cache_ent_t *newer;
+  unsigned long long key;
+  matrix_p_t M[MT_COUNT];
+  unsigned char *seq;
+  unsigned int len;
+  int maxScore;
+  col_t rc;
+  size_t size;
+} cache_ent_t, *cache_ent_p_t;
+
+typedef struct _cache_t {
+  cache_ent_p_t *bucket;
+  unsigned int nBucket;
+  unsigned int nb;
+  cache_ent_p_t newest;
+  cache_ent_p_t oldest;
+  size_t size;
+  size_t limit;
+  pthread_mutex_t lock;
+} cache_t;
+
+/* Key of a record, and its reverse complement if it may be used.  */
+typedef struct _cache_key_t {
+  unsigned long long key;
+  matrix_p_t M[MT_COUNT];
+  unsigned char *rev;
+} cache_key_t, *cache_key_p_t;
+
+static cache_t cache;
+
+static unsigned long long
+hash_bytes(const unsigned char *s, size_t len)
+{
+  unsigned long long h = 0x9e3779b97f4a7c15ULL ^ len;
+  while (len >= 8) {
+    unsigned long long w;
+    memcpy(&w, s, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    s += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    h = (h ^ *s++) * 0x100000001b3ULL;
+    len -= 1;
+  }
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 29);
+}
+
+static void
+init_cache(size_t limit)
+{
+  cache.nBucket = 1024;
+  cache.bucket = (cache_ent_p_t *) xmalloc(cache.nBucket
+					   * sizeof(cache_ent_p_t));
+  memset(cache.bucket, 0, cache.nBucket * sizeof(cache_ent_p_t));
+  cache.nb = 0;
+  cache.newest = NULL;
+  cache.oldest = NULL;
+  cache.size = 0;
+  cache.limit = limit;
+  pthread_mutex_init(&cache.lock, NULL);
+}
+
+static void
+unlink_entry(cache_ent_p_t e)
+{
+  if (e->newer != NULL)
+    e->newer->older = e->older;
+  else
+    cache.newest = e->older;
+  if (e->older != NULL)
+    e->older->newer = e->newer;
+  else
+    cache.oldest = e->newer;
+}
+
+static void
+push_entry(cache_ent_p_t e)
+{
+  e->older = cache.newest;
+  e->newer = NULL;
+  if (cache.newest != NULL)
+    cache.newest->newer = e;
+  else
+    cache.oldest = e;
+  cache.newest = e;
+}
+
+static void
+free_entry(cache_ent_p_t e)
+{
+  free_results(&e->rc);
+  free_col(&e->rc);
+  free(e->seq);
+  free(e);
+}
+
+/* Drop the least recently used entry.  */
+static void
+drop_oldest(void)
+{
+  cache_ent_p_t e = cache.oldest;
+  cache_ent_p_t *p = cache.bucket + (e->key & (cache.nBucket - 1));
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+  unlink_entry(e);
+  cache.size -= e->size;
+  cache.nb -= 1;
+  free_entry(e);
+}
+
+static void
+grow_cache(void)
+{
+  unsigned int n = 2 * cache.nBucket, i;
+  cache_ent_p_t *b = (cache_ent_p_t *) xmalloc(n * sizeof(cache_ent_p_t));
+  memset(b, 0, n * sizeof(cache_ent_p_t));
+  for (i = 0; i < cache.nBucket; i++)
+    while (cache.bucket[i] != NULL) {
+      cache_ent_p_t e = cache.bucket[i];
+      cache.bucket[i] = e->next;
+      e->next = b[e->key & (n - 1)];
+      b[e->key & (n - 1)] = e;
+    }
+  free(cache.bucket);
+  cache.bucket = b;
+  cache.nBucket = n;
+}
+
+static void
+free_cache(void)
+{
+  while (cache.oldest != NULL)
+    drop_oldest();
+  free(cache.bucket);
+  pthread_mutex_destroy(&cache.lock);
+}
+
+/* Compute the key of the record of j, scanned with the matrices of
+   mc.  */
+static void
+cache_key(col_p_t mc, job_p_t j, cache_key_p_t k)
+{
+  unsigned long long key = hash_bytes(es_seq_data(j->seq), es_seq_len(j->seq));
+  if (SelectMatrices(mc, j->seq, k->M) != 0)
+    fatal("%s", es_error());
+  k->rev = NULL;
+  if (options.single == 0) {
+    unsigned char *rev = (unsigned char *) arena_alloc(&j->arena,
+						       es_seq_len(j->seq));
+    if (rev == NULL)
+      fatal("%s", es_error());
+    if (seq_revcomp_copy(j->seq, rev)) {
+      unsigned long long rKey = hash_bytes(rev, es_seq_len(j->seq));
+      k->rev = rev;
+      key = min(key, rKey);
+    }
+  }
+  k->key = key;
+}
+
+/* Entry for the record of j, or its reverse complement if *flip is set
+   on return.  The cache must be locked.  */
+static cache_ent_p_t
+find_entry(job_p_t j, cache_key_p_t k, int *flip)
+{
+  cache_ent_p_t e;
+  for (e = cache.bucket[k->key & (cache.nBucket - 1)]; e != NULL;
+       e = e->next) {
+    if (e->key != k->key || e->len != es_seq_len(j->seq)
+	|| memcmp(e->M, k->M, sizeof(e->M)) != 0)
+      continue;
+    *flip = 0;
+    if (memcmp(e->seq, es_seq_data(j->seq), e->len) == 0)
+      return e;
+    *flip = 1;
+    if (k->rev != NULL && memcmp(e->seq, k->rev, e->len) == 0)
+      return e;
+  }
+  return NULL;
+}
+
+/* Fill in the results of the record of j from the cache, if they are
+   there.  Those of a reverse complement swap strands, and the new
+   forward ones come first, as if the record had been scanned.  */
+static int
+cache_lookup(job_p_t j, cache_key_p_t k)
+{
+  cache_ent_p_t e;
+  int flip, pass;
+  unsigned int i;
+  pthread_mutex_lock(&cache.lock);
+  e = find_entry(j, k, &flip);
+  if (e == NULL) {
+    pthread_mutex_unlock(&cache.lock);
+    return 0;
+  }
+  unlink_entry(e);
+  push_entry(e);
+  for (pass = flip; pass >= 0; pass--)
+    for (i = 0; i < e->rc.nb; i++) {
+      result_p_t r = e->rc.e.r[i];
+      if (flip && r->reverse != pass)
+	continue;
+      if (copy_result(&j->rc, r) != 0)
+	fatal("%s", es_error());
+      j->rc.e.r[j->rc.nb - 1]->reverse ^= flip;
+    }
+  j->maxScore = e->maxScore;
+  pthread_mutex_unlock(&cache.lock);
+  return 1;
+}
+
+static void
+cache_insert(job_p_t j, cache_key_p_t k)
+{
+  cache_ent_p_t e;
+  size_t size = sizeof(cache_ent_t) + es_seq_len(j->seq);
+  unsigned int i;
+  int flip;
+  for (i = 0; i < j->rc.nb; i++) {
+    result_p_t r = j->rc.e.r[i];
+    size += sizeof(result_t) + r->nEdits * sizeof(unsigned int);
+    if (r->s != NULL)
+      size += strlen((char *) r->s) + 1;
+    if (r->aa != NULL)
+      size += strlen(r->aa) + 1;
+  }
+  if (size > cache.limit)
+    return;
+  pthread_mutex_lock(&cache.lock);
+  if (find_entry(j, k, &flip) != NULL) {
+    pthread_mutex_unlock(&cache.lock);
+    return;
+  }
+  e = (cache_ent_p_t) xmalloc(sizeof(cache_ent_t));
+  e->key = k->key;
+  memcpy(e->M, k->M, sizeof(e->M));
+  e->len = es_seq_len(j->seq);
+  e->seq = (unsigned char *) xmalloc(e->len);
+  memcpy(e->seq, es_seq_data(j->seq), e->len);
+  e->maxScore = j->maxScore;
+  if (init_col(&e->rc, max(j->rc.nb, 1)) != 0)
+    fatal("%s", es_error());
+  for (i = 0; i < j->rc.nb; i++)
+    if (copy_result(&e->rc, j->rc.e.r[i]) != 0)
+      fatal("%s", es_error());
+  e->size = size;
+  e->next = cache.bucket[e->key & (cache.nBucket - 1)];
+  cache.bucket[e->key & (cache.nBucket - 1)] = e;
+  push_entry(e);
+  cache.size += size;
+  cache.nb += 1;
+  while (cache.size > cache.limit)
+    drop_oldest();
+  if (cache.nb > cache.nBucket)
+    grow_cache();
+  pthread_mutex_unlock(&cache.lock);
+}
+
+/* Scan the n records of jobs with the scanners sc, using the matrices of
+   mc, in batches when the full Viterbi is needed, unless they are in the
+   cache.  */
+static void
+scan_batch(scanner_p_t *sc, col_p_t mc, job_p_t *jobs, unsigned int n)
+{
+  seq_p_t seqs[BATCH_RECORDS];
+  col_p_t rc[BATCH_RECORDS];
+  int maxScore[BATCH_RECORDS];
+  cache_key_t keys[BATCH_RECORDS];
+  job_p_t scan[BATCH_RECORDS];
+  unsigned int i, nb = 0, ns = 0;
+  for (i = 0; i < n; i++) {
+    /* Records left in the input are not read as a whole.  */
+    if (cache.limit > 0 && es_seq_data(jobs[i]->seq) != NULL) {
+      cache_key(mc, jobs[i], keys + ns);
+      if (cache_lookup(jobs[i], keys + ns))
+	continue;
+    }
+    scan[ns++] = jobs[i];
+  }
+  jobs = scan;
+  n = ns;
+  for (i = 0; i < n; i++) {
+    if (options.maxOnly || es_seq_len(jobs[i]->seq) >= STRAND_THREAD_LEN
+	|| streamed(jobs[i]->seq) || parallel(jobs[i]->seq)) {
+      jobs[i]->maxScore = scan_seq(sc, jobs[i]->seq, &jobs[i]->rc);
+      continue;
+    }
+    seqs[nb] = jobs[i]->seq;
+    rc[nb] = &jobs[i]->rc;
+    maxScore[nb++] = INT_MIN;
+  }
+  if (nb > 0) {
+    if (ComputeBatch(sc[0], seqs, nb, rc, options.single ? 1 : 2, maxScore)
+	!= 0)
+      fatal("%s", es_error());
+    for (i = nb = 0; i < n; i++)
+      if (!options.maxOnly && es_seq_len(jobs[i]->seq) < STRAND_THREAD_LEN
+	  && !streamed(jobs[i]->seq) && !parallel(jobs[i]->seq))
+	jobs[i]->maxScore = maxScore[nb++];
+  }
+  if (cache.limit > 0)
+    for (i = 0; i < n; i++)
+      if (es_seq_data(jobs[i]->seq) != NULL)
+	cache_insert(jobs[i], keys + i);
+}
+
+#define JOB_FREE 0
+#define JOB_PENDING 1
+#define JOB_RUNNING 2
+#define JOB_DONE 3
+
+/* Records are numbered in input order; slot n % size holds record n.
+   Records [out, next) are in flight, and are written in order as soon
+   as the one numbered out is done.  */
+typedef struct _pool_t {
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  job_p_t jobs;
+  col_p_t mc;
+  unsigned long next;
+  unsigned long out;
+  unsigned int size;
+  unsigned int pending;
+  int eof;
+} pool_t, *pool_p_t;
+
+static void *
+worker(void *arg)
+{
+  pool_p_t pool = (pool_p_t) arg;
+  scanner_p_t *sc = new_scanners(pool->mc);
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    job_p_t batch[BATCH_RECORDS];
+    unsigned int nb = 0, i;
+    /* Pick the longest pending records, which makes batches of similar
+       lengths.  */
+    while (nb < BATCH_RECORDS && pool->pending > 0) {
+      job_p_t j = NULL;
+      unsigned long n;
+      for (n = pool->out; n < pool->next; n++) {
+	job_p_t c = pool->jobs + n % pool->size;
+	if (c->state == JOB_PENDING
+	    && (j == NULL || es_seq_len(c->seq) > es_seq_len(j->seq)))
+	  j = c;
+      }
+      j->state = JOB_RUNNING;
+      pool->pending -= 1;
+      batch[nb++] = j;
+    }
+    if (nb == 0) {
+      if (pool->eof)
+	break;
+      pthread_cond_wait(&pool->work, &pool->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    scan_batch(sc, pool->mc, batch, nb);
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < nb; i++)
+      batch[i]->state = JOB_DONE;
+    pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  free_scanners(sc);
+  return NULL;
+}
+
+/* Restrict seq to the byte range of its file given by --byte-range or
+   --shard.  */
+static void
+set_range(seq_p_t seq)
+{
+  size_t start = options.rangeStart, end = options.rangeEnd;
+  if (options.shards > 0) {
+    size_t size = es_seq_size(seq);
+    unsigned int n = options.shards, k = options.shard - 1;
+    start = size / n * k + size % n * k / n;
+    end = size / n * (k + 1) + size % n * (k + 1) / n;
+  } else if (start == 0 && end == SIZE_MAX)
+    return;
+  if (seq_set_range(seq, start, end) != 0)
+    fatal("%s", es_error());
+}
+
+/* Open fName, or stdin if NULL.  */
+static seq_p_t
+open_seq(const char *fName)
+{
+  seq_p_t seq = es_seq_open(fName);
+  if (seq == NULL)
+    fatal("%s", es_error());
+  return seq;
+}
+
+/* Next line of in, *len bytes long, or NULL at its end.  */
+static const char *
+next_line(seq_p_t in, size_t *len)
+{
+  const char *line;
+  if (seq_next_line(in, &line, len) != 0)
+    fatal("%s", es_error());
+  return line;
+}
+
+/* Identifiers of the records to scan, see --ids, and the offsets of the
+   sequences of those in the current input file, from its index.  */
+typedef struct _wanted_t {
+  char **id;
+  unsigned int nb;
+  /* Indices of the identifiers, sorted by them, without duplicates.  */
+  unsigned int *sorted;
+  unsigned int nSorted;
+  const char *fName;
+  size_t *at;
+  unsigned char *found;
+  unsigned int next;
+} wanted_t;
+
+static wanted_t wanted;
+
+/* Copy the first word of line, of len bytes, to *buf of *max bytes.  */
+static char *
+first_word(const char *line, size_t len, char **buf, size_t *max)
+{
+  size_t n = 0;
+  while (n < len && !isspace((unsigned char) line[n]))
+    n += 1;
+  if (n + 1 > *max) {
+    *max = n + 1;
+    *buf = (char *) xrealloc(*buf, *max);
+  }
+  memcpy(*buf, line, n);
+  (*buf)[n] = 0;
+  return *buf;
+}
+
+static int
+wanted_compare(const void *a, const void *b)
+{
+  return strcmp(wanted.id[*(const unsigned int *) a],
+		wanted.id[*(const unsigned int *) b]);
+}
+
+static int
+wanted_find(const void *key, const void *elt)
+{
+  return strcmp((const char *) key, wanted.id[*(const unsigned int *) elt]);
+}
+
+static void
+read_ids(const char *fName)
+{
+  seq_p_t in;
+  const char *line;
+  size_t len, max = 0;
+  char *buf = NULL;
+  unsigned int i, maxId = 1024;
+  wanted.id = (char **) xmalloc(maxId * sizeof(char *));
+  wanted.nb = 0;
+  in = open_seq(fName);
+  while ((line = next_line(in, &len)) != NULL) {
+    if (len > 0 && line[0] == '>')
+      line += 1, len -= 1;
+    if (*first_word(line, len, &buf, &max) == 0)
+      continue;
+    if (wanted.nb == maxId) {
+      maxId *= 2;
+      wanted.id = (char **) xrealloc(wanted.id, maxId * sizeof(char *));
+    }
+    wanted.id[wanted.nb++] = strcpy((char *) xmalloc(strlen(buf) + 1), buf);
+  }
+  es_seq_close(in);
+  free(buf);
+  wanted.sorted = (unsigned int *) xmalloc((wanted.nb + 1)
+					   * sizeof(unsigned int));
+  for (i = 0; i < wanted.nb; i++)
+    wanted.sorted[i] = i;
+  qsort(wanted.sorted, wanted.nb, sizeof(unsigned int), wanted_compare);
+  /* Scan a record once, where it is first listed.  */
+  wanted.nSorted = 0;
+  for (i = 0; i < wanted.nb; i++) {
+    unsigned int *last = wanted.sorted + wanted.nSorted - 1;
+    if (wanted.nSorted > 0 && wanted_compare(last, wanted.sorted + i) == 0) {
+      *last = min(*last, wanted.sorted[i]);
+      continue;
+    }
+    wanted.sorted[wanted.nSorted++] = wanted.sorted[i];
+  }
+  wanted.at = (size_t *) xmalloc((wanted.nb + 1) * sizeof(size_t));
+  wanted.found = (unsigned char *) xmalloc(wanted.nb + 1);
+  memset(wanted.found, 0, wanted.nb + 1);
+}
+
+/* Look the wanted records up in the index of the input file fName.  */
+static void
+find_ids(const char *fName)
+{
+  seq_p_t in;
+  const char *line;
+  size_t len, max = 0;
+  char *buf = NULL, *iName;
+  unsigned int i;
+  if (fName == NULL)
+    fatal("--ids needs indexed input files\n");
+  iName = (char *) xmalloc(strlen(fName) + 5);
+  strcat(strcpy(iName, fName), ".fai");
+  if (access(iName, R_OK) != 0)
+    fatal("Could not read the index %s: %s(%d), see --index\n", iName,
+	  strerror(errno), errno);
+  for (i = 0; i < wanted.nb; i++)
+    wanted.at[i] = SIZE_MAX;
+  wanted.fName = fName;
+  wanted.next = 0;
+  in = open_seq(iName);
+  while ((line = next_line(in, &len)) != NULL) {
+    const unsigned int *e;
+    char *p;
+    /* Name, length, offset, ... of a record.  */
+    first_word(line, len, &buf, &max);
+    e = bsearch(buf, wanted.sorted, wanted.nSorted, sizeof(unsigned int),
+		wanted_find);
+    if (e == NULL || wanted.at[*e] != SIZE_MAX)
+      continue;
+    /* Parse the rest of the line from a copy, with a NUL at its end.  */
+    if (len + 1 > max) {
+      max = len + 1;
+      buf = (char *) xrealloc(buf, max);
+    }
+    memcpy(buf, line, len);
+    buf[len] = 0;
+    p = strchr(buf, '\t');
+    if (p == NULL || (p = strchr(p + 1, '\t')) == NULL)
+      fatal("Bad index line in %s: %s", iName, buf);
+    wanted.at[*e] = strtoull(p + 1, NULL, 10);
+    wanted.found[*e] = 1;
+  }
+  es_seq_close(in);
+  free(buf);
+  free(iName);
+}
+
+/* Read the next record to scan, returning 0, or 1 at the end.  */
+static int
+read_seq(seq_p_t seq)
+{
+  int res;
+  if (options.ids == NULL) {
+    if ((res = get_next_seq(seq)) < 0)
+      fatal("%s", es_error());
+    return res;
+  }
+  while (wanted.next < wanted.nb) {
+    const char *id = wanted.id[wanted.next];
+    size_t at = wanted.at[wanted.next++], n = strlen(id);
+    if (at == SIZE_MAX)
+      continue;
+    if (seq_seek_record(seq, at) != 0 || (res = get_next_seq(seq)) < 0)
+      fatal("%s", es_error());
+    /* get_next_seq ends the header with "; LEN=".  */
+    if (res != 0 || strncmp(es_seq_header(seq) + 1, id, n) != 0
+	|| (es_seq_header(seq)[n + 1] != ';'
+	    && !isspace((unsigned char) es_seq_header(seq)[n + 1])))
+      fatal("Record %s is not at offset %zu of %s, is its index out of "
+	    "date?\n", id, at, wanted.fName);
+    return 0;
+  }
+  return 1;
+}
+
+static void
+free_ids(void)
+{
+  unsigned int i;
+  for (i = 0; i < wanted.nb; i++) {
+    /* Duplicates are only looked up where first listed.  */
+    const unsigned int *e = bsearch(wanted.id[i], wanted.sorted,
+				    wanted.nSorted, sizeof(unsigned int),
+				    wanted_find);
+    if (*e == i && !wanted.found[i])
+      fprintf(stderr, "%s: Warning: record %s not found\n", argv0,
+	      wanted.id[i]);
+  }
+  for (i = 0; i < wanted.nb; i++)
+    free(wanted.id[i]);
+  free(wanted.id);
+  free(wanted.sorted);
+  free(wanted.at);
+  free(wanted.found);
+}
+
+/* Write the index of the FASTA file fName to fName.fai, in the format of
+   samtools faidx: name, length, offset of the sequence, and letters and
+   bytes per line of each record, followed by its C+G percentage.  */
+static void
+write_index(const char *fName)
+{
+  seq_p_t in;
+  FILE *f;
+  const char *line;
+  size_t len, max = 0;
+  size_t bases = 0, offset = 0, lineBases = 0, lineBytes = 0;
+  unsigned long long gc = 0, atgc = 0;
+  char *name = NULL, *iName;
+  if (fName == NULL)
+    fatal("--index needs input files\n");
+  in = open_seq(fName);
+  /* The offsets are those of a mapped input, which this checks.  */
+  if (seq_set_range(in, 0, SIZE_MAX) != 0)
+    fatal("%s", es_error());
+  iName = (char *) xmalloc(strlen(fName) + 5);
+  strcat(strcpy(iName, fName), ".fai");
+  if ((f = fopen(iName, "w")) == NULL)
+    fatal("Could not open file %s: %s(%d)\n", iName, strerror(errno),
+	  errno);
+  while (1) {
+    size_t i, n = 0;
+    line = next_line(in, &len);
+    if (line == NULL || line[0] == '>') {
+      if (name != NULL)
+	fprintf(f, "%s\t%zu\t%zu\t%zu\t%zu\t%.2f\n", name, bases, offset,
+		lineBases, lineBytes,
+		atgc == 0 ? 0.0 : 100.0 * (double) gc / (double) atgc);
+      if (line == NULL)
+	break;
+      first_word(line + 1, len - 1, &name, &max);
+      offset = seq_tell(in);
+      bases = lineBases = lineBytes = 0;
+      gc = atgc = 0;
+      continue;
+    }
+    if (name == NULL)
+      continue;
+    for (i = 0; i < len; i++) {
+      unsigned char c = toupper((unsigned char) line[i]);
+      if (!isgraph(c))
+	continue;
+      n += 1;
+      if (c == 'G' || c == 'C')
+	gc += 1, atgc += 1;
+      else if (c == 'A' || c == 'T')
+	atgc += 1;
+    }
+    if (lineBytes == 0) {
+      lineBases = n;
+      lineBytes = len;
+    }
+    bases += n;
+  }
+  if (fclose(f) != 0)
+    fatal("Could not write %s: %s(%d)\n", iName, strerror(errno), errno);
+  es_seq_close(in);
+  free(name);
+  free(iName);
+}
+
+/* Input file being read, and point to resume the run from, see
+   --resume.  */
+static unsigned int inputFile;
+static ckpt_t resumed;
+
+/* Open the input file fName, at its first record to scan.  */
+static seq_p_t
+open_input(const char *fName)
+{
+  seq_p_t seq = open_seq(fName);
+  set_range(seq);
+  if (options.ids != NULL)
+    find_ids(fName);
+  if (resumed.in > 0 && resumed.file == inputFile
+      && seq_seek(seq, resumed.in) != 0)
+    fatal("%s", es_error());
+  es_seq_stream(seq, options.streamMin);
+  return seq;
+}
+
+static void
+process_file_threaded(const char *fName, col_p_t mc)
+{
+  pool_t pool;
+  seq_p_t seq;
+  pthread_t *tid;
+  unsigned int i;
+  pool.size = 2 * BATCH_RECORDS * options.threads;
+  pool.jobs = (job_p_t) xmalloc(pool.size * sizeof(job_t));
+  for (i = 0; i < pool.size; i++) {
+    job_p_t j = pool.jobs + i;
+    if ((j->seq = es_seq_new()) == NULL)
+      fatal("%s", es_error());
+    j->state = JOB_FREE;
+    if (init_col(&j->rc, 8) != 0)
+      fatal("%s", es_error());
+    init_arena(&j->arena);
+    j->rc.arena = &j->arena;
+  }
+  pool.mc = mc;
+  pool.next = 0;
+  pool.out = 0;
+  pool.pending = 0;
+  pool.eof = 0;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.work, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  tid = (pthread_t *) xmalloc(options.threads * sizeof(pthread_t));
+  for (i = 0; i < (unsigned int) options.threads; i++)
+    if ((errno = pthread_create(tid + i, NULL, worker, &pool)) != 0)
+      fatal("Could not create thread: %s(%d)\n", strerror(errno), errno);
+  seq = open_input(fName);
+  pthread_mutex_lock(&pool.lock);
+  while (!pool.eof || pool.out < pool.next) {
+    job_p_t j = pool.jobs + pool.out % pool.size;
+    if (pool.out < pool.next && j->state == JOB_DONE) {
+      /* Write out the oldest record.  */
+      pthread_mutex_unlock(&pool.lock);
+      showResults(&j->rc, j->seq, j->maxScore);
+      if (options.checkpoint != NULL)
+	out_mark(inputFile, j->end);
+      free_results(&j->rc);
+      pthread_mutex_lock(&pool.lock);
+      j->state = JOB_FREE;
+      pool.out += 1;
+    } else if (!pool.eof && pool.next - pool.out < pool.size) {
+      /* Read the next record into a free slot.  */
+      int res;
+      pthread_mutex_unlock(&pool.lock);
+      while ((res = read_seq(seq)) == 0 && es_seq_len(seq) == 0)
+	;
+      pthread_mutex_lock(&pool.lock);
+      if (res != 0)
+	pool.eof = 1;
+      else {
+	j = pool.jobs + pool.next % pool.size;
+	es_seq_swap(j->seq, seq);
+	j->end = seq_tell(seq);
+	j->state = JOB_PENDING;
+	pool.next += 1;
+	pool.pending += 1;
+      }
+      pthread_cond_broadcast(&pool.work);
+    } else
+      pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+  for (i = 0; i < (unsigned int) options.threads; i++)
+    pthread_join(tid[i], NULL);
+  es_seq_close(seq);
+  for (i = 0; i < pool.size; i++) {
+    es_seq_close(pool.jobs[i].seq);
+    free_col(&pool.jobs[i].rc);
+    free_arena(&pool.jobs[i].arena);
+  }
+  free(pool.jobs);
+  free(tid);
+  pthread_mutex_destroy(&pool.lock);
+  pthread_cond_destroy(&pool.work);
+  pthread_cond_destroy(&pool.done);
+}
+
+static void
+process_file(const char *fName, col_p_t mc)
+{
+  job_t jobs[BATCH_RECORDS];
+  job_p_t batch[BATCH_RECORDS];
+  seq_p_t seq;
+  scanner_p_t *sc;
+  unsigned int i, n;
+  int eof = 0;
+  if (options.threads > 0) {
+    process_file_threaded(fName, mc);
+    return;
+  }
+  sc = new_scanners(mc);
+  for (i = 0; i < BATCH_RECORDS; i++) {
+    if ((jobs[i].seq = es_seq_new()) == NULL)
+      fatal("%s", es_error());
+    if (init_col(&jobs[i].rc, 8) != 0)
+      fatal("%s", es_error());
+    init_arena(&jobs[i].arena);
+    jobs[i].rc.arena = &jobs[i].arena;
+    batch[i] = jobs + i;
+  }
+  seq = open_input(fName);
+  while (!eof) {
+    for (n = 0; n < BATCH_RECORDS; ) {
+      if (read_seq(seq) != 0) {
+	eof = 1;
+	break;
+      }
+      if (es_seq_len(seq) > 0) {
+	jobs[n].end = seq_tell(seq);
+	es_seq_swap(jobs[n++].seq, seq);
+      }
+    }
+    if (n > 0)
+      scan_batch(sc, mc, batch, n);
+    for (i = 0; i < n; i++) {
+      showResults(&jobs[i].rc, jobs[i].seq, jobs[i].maxScore);
+      if (options.checkpoint != NULL)
+	out_mark(inputFile, jobs[i].end);
+      free_results(&jobs[i].rc);
+    }
+  }
+  es_seq_close(seq);
+  for (i = 0; i < BATCH_RECORDS; i++) {
+    es_seq_close(jobs[i].seq);
+    free_col(&jobs[i].rc);
+    free_arena(&jobs[i].arena);
+  }
+  free_scanners(sc);
+/*
+    my $bigMax = ESTScan::Compute($seq->{_seq}, $main::iPen, $main::dPen, $main::min,
+				  $main::maxOnly == 0 ? \@res : undef, $matIndex,
+				  $utrMatIndex, $startMatIndex, $stopMatIndex,
+				  $main::minLen);
+    my $result_nr = -1;
+    if ($main::single != 0) {
 	showResults($seq, \@res, $bigMax, \$result_nr, $bigMax);
 	next;
     }
@@ -1467,14 +2101,87 @@ process_file(const char *fName, col_p_t mc)
 */
 }
 
+/* Check that the run can have checkpoints, and read the point to
+   resume it from, if any.  */
+static void
+read_checkpoint(void)
+{
+  const char *names[2] = { options.outName, options.translName };
+  unsigned int d, nb = max(options.nInputs, 1);
+  char *line = NULL;
+  size_t max = 0;
+  FILE *f;
+  for (d = 0; d < 2; d++) {
+    size_t len = names[d] != NULL ? strlen(names[d]) : 0;
+    if (names[d] != NULL && (strcmp(names[d], "-") == 0
+			     || (len > 3 && strcmp(names[d] + len - 3, ".gz")
+				 == 0)
+			     || (len > 4 && strcmp(names[d] + len - 4, ".zst")
+				 == 0)))
+      fatal("--checkpoint needs uncompressed -o and -t files\n");
+  }
+  if (options.ids != NULL)
+    fatal("--checkpoint cannot be used with --ids\n");
+  if (!options.resume)
+    return;
+  if ((f = fopen(options.checkpoint, "r")) == NULL) {
+    /* Nothing written yet.  */
+    if (errno == ENOENT)
+      return;
+    fatal("Could not open file %s: %s(%d)\n", options.checkpoint,
+	  strerror(errno), errno);
+  }
+  while (getline(&line, &max, f) > 0) {
+    int at;
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%u %zu %zu %zu %n", &resumed.file, &resumed.in,
+	       resumed.out, resumed.out + 1, &at) < 4)
+      fatal("Bad checkpoint in %s: %s", options.checkpoint, line);
+    line[strcspn(line, "\n")] = 0;
+    if (resumed.file >= nb
+	|| strcmp(line + at, options.nInputs > 0
+		  ? options.inputs[resumed.file] : "-") != 0)
+      fatal("Checkpoint %s is not for the input files given\n",
+	    options.checkpoint);
+    break;
+  }
+  fclose(f);
+  free(line);
+}
+
+/* Concatenate the output files of the shards of a run, keeping the
+   header lines of the first one only.  */
+static void
+merge_outputs(char **files, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    seq_p_t in;
+    const char *line;
+    size_t len;
+    int head = i > 0;
+    in = open_seq(files[i]);
+    while ((line = next_line(in, &len)) != NULL) {
+      if (head && line[0] == '#')
+	continue;
+      head = 0;
+      out_write(OUT_NT, line, len);
+      if (writer.cur->len >= OUT_BUF_SIZE)
+	out_flush();
+    }
+    es_seq_close(in);
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
   const char *ESTScanDir;
   int getHelp = 0;
+  const char *compile = NULL;
   col_t mc;
 #ifdef DEBUG
-  unsigned int i;
   mcheck(NULL);
   mtrace();
 #endif
@@ -1487,31 +2194,39 @@ main(int argc, char *argv[])
     ESTScanDir = "/usr/molbio/share/ESTScan";
   options.matrix = xmalloc((strlen(ESTScanDir) + 9) * sizeof(char));
   strcat(strcpy(options.matrix, ESTScanDir), "/Hs.smat");
-  options.min = -100;
-  options.dPen = -50;
-  options.iPen = -50;
-  options.ts5uPen = -10;
-  options.tscPen = -10;
-  options.ts3uPen = -5;
-  options.t5ucPen = -80;
-  options.t5uePen = -40;
-  options.tc3uPen = -80;
-  options.tcePen = -40;
-  options.t3uePen = -20;
-  options.percent = 4.0;
-  options.Nvalue = 0;
+  default_params(&options.p);
   options.sWidth = 60;
   options.all = 0;
   options.maxOnly = 0;
   options.skipLen = 1;
-  options.minLen = 50;
   options.transl = NULL;
-  options.out = stdout;
+  options.out = NULL;
+  options.outName = "-";
+  options.translName = NULL;
+  options.checkpoint = NULL;
+  options.ckEvery = 60;
+  options.resume = 0;
   options.both = 1.0;
   options.no_del = 0;
+  options.protOnly = 0;
+  options.format = FMT_FASTA;
+  options.cacheMB = 0;
+  options.streamMin = 0;
+  options.parMin = 0;
+  options.rangeStart = 0;
+  options.rangeEnd = SIZE_MAX;
+  options.shard = 0;
+  options.shards = 0;
+  options.ids = NULL;
+  options.index = 0;
+  options.merge = 0;
   options.single = 0;
+  options.threads = 0;
   while (1) {
-    int c = getopt(argc, argv, "ab:d:hi:l:M:m:N:nOo:p:Ss:T:t:vw:");
+    int c = getopt_long(argc, argv,
+			"ab:C:c:d:f:G:hi:j:L:l:M:m:N:nOo:Pp:Ss:T:t:vw:",
+			LongOptions, NULL);
+    char *end;
     if (c == -1)
       break;
     switch (c) {
@@ -1521,26 +2236,57 @@ main(int argc, char *argv[])
     case 'b':
       options.both = atof(optarg);
       break;
+    case 'C':
+      compile = optarg;
+      break;
+    case 'c':
+      options.cacheMB = atoi(optarg);
+      if (options.cacheMB < 0)
+	fatal("Bad cache size: %d\n", options.cacheMB);
+      break;
     case 'd':
-      options.dPen = atoi(optarg);
+      options.p.dPen = atoi(optarg);
+      break;
+    case 'f':
+      if (strcmp(optarg, "fasta") == 0)
+	options.format = FMT_FASTA;
+      else if (strcmp(optarg, "gff3") == 0)
+	options.format = FMT_GFF3;
+      else if (strcmp(optarg, "bed") == 0)
+	options.format = FMT_BED;
+      else if (strcmp(optarg, "tsv") == 0)
+	options.format = FMT_TSV;
+      else
+	fatal("Unknown output format: %s\n", optarg);
+      break;
+    case 'G':
+      options.parMin = strtoul(optarg, NULL, 10);
       break;
     case 'h':
       getHelp = 1;
       break;
     case 'i':
-      options.iPen = atoi(optarg);
+      options.p.iPen = atoi(optarg);
+      break;
+    case 'j':
+      options.threads = atoi(optarg);
+      if (options.threads < 0)
+	fatal("Bad number of threads: %d\n", options.threads);
+      break;
+    case 'L':
+      options.streamMin = strtoul(optarg, NULL, 10);
       break;
     case 'l':
-      options.minLen = atoi(optarg);
+      options.p.minLen = atoi(optarg);
       break;
     case 'M':
       options.matrix = optarg;
       break;
     case 'm':
-      options.min = atoi(optarg);
+      options.p.min = atoi(optarg);
       break;
     case 'N':
-      options.Nvalue = atoi(optarg);
+      options.p.Nvalue = atoi(optarg);
       break;
     case 'n':
       options.no_del = 1;
@@ -1549,17 +2295,13 @@ main(int argc, char *argv[])
       options.maxOnly = 1;
       break;
     case 'o':
-      if (strcmp(optarg, "-") == 0) {
-	options.out = stdout;
-      } else {
-	options.out = fopen(optarg, "w");
-	if (options.out == NULL)
-	  fatal("Couldn't create file %s: %s (%d)\n", optarg,
-		strerror(errno), errno);
-      }
+      options.outName = optarg;
+      break;
+    case 'P':
+      options.protOnly = 1;
       break;
     case 'p':
-      options.percent = atof(optarg);
+      options.p.percent = atof(optarg);
       break;
     case 'S':
       options.single = 1;
@@ -1579,16 +2321,10 @@ main(int argc, char *argv[])
       fputs("Option T is not yet implemented...\n", stderr);
       return 1;
     case 't':
-      if (strcmp(optarg, "-") == 0) {
-	options.transl = stdout;
-	if (options.out == options.transl)
-	  options.out = NULL;
-      } else {
-	options.transl = fopen(optarg, "w");
-	if (options.transl == NULL)
-	  fatal("Couldn't create file %s: %s (%d)\n", optarg,
-		strerror(errno), errno);
-      }
+      options.translName = optarg;
+      if (strcmp(optarg, "-") == 0 && options.outName != NULL
+	  && strcmp(options.outName, "-") == 0)
+	options.outName = NULL;
       break;
     case 'v':
       fputs(Version, stderr);
@@ -1596,6 +2332,41 @@ main(int argc, char *argv[])
     case 'w':
       options.sWidth = atoi(optarg);
       break;
+    case OPT_BYTE_RANGE:
+      options.rangeStart = strtoull(optarg, &end, 10);
+      if (*end != ':')
+	fatal("Bad byte range: %s\n", optarg);
+      if (end[1] != 0) {
+	options.rangeEnd = strtoull(end + 1, &end, 10);
+	if (*end != 0 || options.rangeEnd < options.rangeStart)
+	  fatal("Bad byte range: %s\n", optarg);
+      }
+      break;
+    case OPT_CHECKPOINT:
+      options.checkpoint = optarg;
+      break;
+    case OPT_CHECKPOINT_EVERY:
+      options.ckEvery = strtoul(optarg, NULL, 10);
+      break;
+    case OPT_IDS:
+      options.ids = optarg;
+      break;
+    case OPT_INDEX:
+      options.index = 1;
+      break;
+    case OPT_MERGE:
+      options.merge = 1;
+      break;
+    case OPT_RESUME:
+      options.resume = 1;
+      break;
+    case OPT_SHARD:
+      options.shard = strtoul(optarg, &end, 10);
+      if (*end == '/')
+	options.shards = strtoul(end + 1, &end, 10);
+      if (*end != 0 || options.shard < 1 || options.shard > options.shards)
+	fatal("Bad shard: %s, expected <i>/<n> with 1 <= i <= n\n", optarg);
+      break;
     case '?':
       break;
     default:
@@ -1603,44 +2374,110 @@ main(int argc, char *argv[])
     }
   }
   if (getHelp) {
-    fprintf(stderr, Usage, argv[0], options.both, options.dPen,
-	    options.iPen, options.minLen, options.matrix, options.min,
-	    options.Nvalue, options.percent, options.skipLen,
-	    options.ts5uPen, options.tscPen, options.ts3uPen,
-	    options.t5ucPen, options.t5uePen, options.tc3uPen,
-	    options.tcePen, options.t3uePen, options.sWidth);
+    fprintf(stderr, Usage, argv[0], argv[0], argv[0], options.both,
+	    options.cacheMB, options.p.dPen, options.parMin,
+	    options.p.iPen, options.threads, options.streamMin,
+	    options.p.minLen, options.matrix, options.p.min,
+	    options.p.Nvalue, options.p.percent, options.skipLen,
+	    options.p.ts5uPen, options.p.tscPen, options.p.ts3uPen,
+	    options.p.t5ucPen, options.p.t5uePen, options.p.tc3uPen,
+	    options.p.tcePen, options.p.t3uePen, options.sWidth,
+	    options.ckEvery);
     return 1;
   }
-  LoadMatrix(options.matrix, &mc);
-#ifdef DEBUG
-  fprintf(stderr, "We have loaded %u matrices:\n", mc.nb);
-  for (i = 0; i < mc.nb; i++) {
-    matrix_p_t m = mc.e.m[i];
-    fprintf(stderr, "%u: %s %s %d %.2f %.2f %u %u %d\n", i,
-	    m->name, m->kind, m->matType, m->CGmin, m->CGmax,
-	    m->order, m->frames, m->offset);
+  if (options.merge) {
+    if (optind >= argc)
+      fatal("--merge needs the output files to merge\n");
+    options.out = open_named(options.outName, 0);
+    start_writer(options.out, NULL, &resumed);
+    merge_outputs(argv + optind, argc - optind);
+    stop_writer();
+    close_output(options.out);
+    return 0;
   }
-#endif
-  if (optind >= argc)
-    process_file(NULL, &mc);
-  else
+  if (options.index) {
+    if (optind >= argc)
+      fatal("--index needs the FASTA files to index\n");
     while (optind < argc)
-      process_file(argv[optind++], &mc);
+      write_index(argv[optind++]);
+    return 0;
+  }
+  if (options.ids != NULL && (options.shards > 0 || options.rangeStart > 0
+			      || options.rangeEnd != SIZE_MAX))
+    fatal("--ids cannot be used with --shard or --byte-range\n");
+  if (options.shards > 0 && (options.rangeStart > 0
+			     || options.rangeEnd != SIZE_MAX))
+    fatal("--shard cannot be used with --byte-range\n");
+  if (compile != NULL) {
+    /* Keep the C+G ranges of the file, -p applies when loading.  */
+    params_t p = options.p;
+    p.percent = 0.0;
+    if (LoadMatrix(options.matrix, &p, &mc) != 0
+	|| SaveMatrices(compile, &p, &mc) != 0)
+      fatal("%s", es_error());
+    FreeMatrices(&mc);
+    return 0;
+  }
+  if (options.protOnly) {
+    if (options.translName == NULL)
+      options.translName = "-";
+    options.outName = NULL;
+  }
+  if (options.format != FMT_FASTA && (options.all || options.maxOnly
+				      || options.translName != NULL))
+    fatal("-f %s cannot be used with -a, -O, -P or -t\n",
+	  options.format == FMT_GFF3 ? "gff3"
+	  : options.format == FMT_BED ? "bed" : "tsv");
+  if (options.all && options.streamMin > 0)
+    fatal("-a cannot be used with -L\n");
+  options.inputs = argv + optind;
+  options.nInputs = argc - optind;
+  if (options.checkpoint != NULL)
+    read_checkpoint();
+  else if (options.resume)
+    fatal("--resume needs --checkpoint\n");
+  /* The files of the writer, see start_writer.  */
+  options.out = open_named(options.outName, resumed.out[0]);
+  options.transl = open_named(options.translName,
+			      resumed.out[options.out != NULL]);
+  /* The nucleotides lose their insertions when translated too.  */
+  options.p.results = 0;
+  if (options.out != NULL)
+    options.p.results |= RES_SEQ;
+  if (options.transl != NULL)
+    options.p.results |= RES_PROT;
+  if (options.no_del != 0 || options.transl != NULL)
+    options.p.results |= RES_NO_DEL;
+  if (options.format != FMT_FASTA)
+    options.p.results = RES_EDITS;
+  if (LoadMatrix(options.matrix, &options.p, &mc) != 0)
+    fatal("%s", es_error());
+  start_writer(options.out, options.transl, &resumed);
+  if (options.cacheMB > 0)
+    init_cache((size_t) options.cacheMB << 20);
+  if (options.ids != NULL)
+    read_ids(options.ids);
+  /* A resumed run has its header already.  */
+  if (resumed.in == 0 && options.format == FMT_GFF3)
+    out_write(OUT_NT, "##gff-version 3\n", 16);
+  else if (resumed.in == 0 && options.format == FMT_TSV)
+    out_printf(OUT_NT, "#id\tstart\tend\tstrand\tscore\tphase\t"
+	       "insertions\tdeletions\n");
+  if (options.nInputs == 0)
+    process_file(NULL, &mc);
+  for (inputFile = resumed.file; inputFile < options.nInputs; inputFile++)
+    process_file(options.inputs[inputFile], &mc);
+  stop_writer();
+  if (options.ids != NULL)
+    free_ids();
+  if (options.cacheMB > 0)
+    free_cache();
+  close_output(options.out);
+  close_output(options.transl);
 #ifdef DEBUG
-  for (i = 0; i < mc.nb; i++) {
-    matrix_p_t m = mc.e.m[i];
-    unsigned int j;
-    for (j = 0; j < m->frames; j++)
-      free(m->m[j]);
-    free(m->m);
-    free(m->name);
-    free(m->kind);
-    free(m);
-  }
-  free_col(&mc);
-  free(V);
-  free(tr);
+  FreeMatrices(&mc);
   free(options.matrix);
+  free(outHead);
 #endif
   return 0;
 }
@@ -0,0 +1,180 @@
+/* $Id$
+ *
+ * Christian Iseli, LICR ITO, Christian.Iseli@licr.org
+ *
+ * Copyright (c) 2004 Swiss Institute of Bioinformatics.  All rights reserved.
+ *
+ * Interface to libestscan, the coding region detection engine used by
+ * the estscan program.  All state of a scan lives in a scanner_t, so
+ * that several scanners may run concurrently, each in its own thread,
+ * sharing the same read-only set of score matrices.
+ *
+ * The library never exits: its functions which may fail return -1, or
+ * NULL, and es_error then tells why.
+ */
+#ifndef ESTSCAN_H
+#define ESTSCAN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MT_UNKNOWN -1
+#define MT_CODING 0
+#define MT_UNTRANSLATED 1
+#define MT_START 2
+#define MT_STOP 3
+#define MT_COUNT 4
+
+/* The score matrices, the input files and their records, and the
+   scanners are only handled through pointers, so that their layout may
+   change without breaking the callers.  */
+typedef struct _matrix matrix_t, *matrix_p_t;
+typedef struct _seq_t seq_t, *seq_p_t;
+typedef struct _scanner_t scanner_t, *scanner_p_t;
+
+typedef struct _result_t {
+  /* Coding sequence and its translation, when asked for in the
+     params.  */
+  unsigned char *s;
+  char *aa;
+  /* With RES_EDITS, the positions of the inserted nucleotides, and with
+     EDIT_DEL set those of the nucleotides following a deletion, first
+     to last on the strand.  */
+  unsigned int *edits;
+  unsigned int nEdits;
+  /* Bases before the first complete codon.  */
+  int phase;
+  int score;
+  unsigned int start;
+  unsigned int stop;
+  int reverse;
+} result_t, *result_p_t;
+
+#define EDIT_DEL 0x80000000U
+
+/* Memory for the results of a record, given out in order from a list of
+   blocks, and taken back all at once.  The blocks are kept for the next
+   record.  */
+typedef struct _arena_blk_t {
+  struct _arena_blk_t *next;
+  size_t size;
+  size_t used;
+} arena_blk_t, *arena_blk_p_t;
+
+typedef struct _arena_t {
+  arena_blk_p_t first;
+  arena_blk_p_t cur;
+} arena_t, *arena_p_t;
+
+typedef union _col_elt_t {
+  void **elt;
+  matrix_p_t *m;
+  result_p_t *r;
+} col_elt_t;
+
+typedef struct _col_t {
+  col_elt_t e;
+  unsigned int size;
+  unsigned int nb;
+  /* Arena holding the results of a result column, or NULL if each one
+     was allocated on its own.  */
+  arena_p_t arena;
+} col_t, *col_p_t;
+
+/* What Compute builds for each result: the coding sequence, without
+   the inserted nucleotides with RES_NO_DEL, the protein, and the list of
+   edits.  */
+#define RES_SEQ 1
+#define RES_PROT 2
+#define RES_NO_DEL 4
+#define RES_EDITS 8
+
+/* Scoring parameters.  min, Nvalue and percent are used when loading
+   the matrices, the others when scanning.  */
+typedef struct _params_t {
+  double percent;
+  int min;
+  int dPen;
+  int iPen;
+  int ts5uPen;
+  int tscPen;
+  int ts3uPen;
+  int t5ucPen;
+  int t5uePen;
+  int tc3uPen;
+  int tcePen;
+  int t3uePen;
+  int Nvalue;
+  int minLen;
+  int results;
+} params_t, *params_p_t;
+
+/* Number of sequences scanned together by ComputeBatch.  */
+#define BATCH_LANES 16
+
+const char *es_error(void);
+
+seq_p_t es_seq_open(const char *fName);
+seq_p_t es_seq_new(void);
+void es_seq_close(seq_p_t sp);
+const char *es_seq_header(const seq_t *sp);
+unsigned int es_seq_len(const seq_t *sp);
+double es_seq_GC_pct(const seq_t *sp);
+const unsigned char *es_seq_data(const seq_t *sp);
+size_t es_seq_size(const seq_t *sp);
+void es_seq_stream(seq_p_t sp, size_t streamMin);
+void es_seq_swap(seq_p_t dst, seq_p_t src);
+int get_next_seq(seq_p_t sp);
+int seq_set_range(seq_p_t sp, size_t start, size_t end);
+int seq_seek_record(seq_p_t sp, size_t offset);
+size_t seq_tell(const seq_t *sp);
+int seq_seek(seq_p_t sp, size_t offset);
+int seq_next_line(seq_p_t sp, const char **line, size_t *len);
+void seq_revcomp_inplace(seq_p_t seq);
+int seq_revcomp_copy(const seq_t *seq, unsigned char *dst);
+unsigned int seq_read_strand(const seq_t *seq, int reverse, size_t *at,
+			     unsigned char *dst, unsigned int n);
+void seq_strand_lower(const seq_t *seq, int reverse, unsigned int pos,
+		      unsigned int n, char *dst);
+
+int init_col(col_p_t c, unsigned int size);
+int add_col_elt(col_p_t c, void *elt, unsigned int grow);
+void free_col(col_p_t c);
+
+void init_arena(arena_p_t a);
+void *arena_alloc(arena_p_t a, size_t size);
+void reset_arena(arena_p_t a);
+void free_arena(arena_p_t a);
+
+void default_params(params_p_t p);
+int LoadMatrix(const char *fName, const params_t *p, col_p_t mc);
+int SaveMatrices(const char *fName, const params_t *p, col_p_t mc);
+void FreeMatrices(col_p_t mc);
+int SelectMatrices(col_p_t mc, seq_p_t seq, matrix_p_t *M);
+
+scanner_p_t es_scanner_new(col_p_t mc, const params_t *p);
+void es_scanner_free(scanner_p_t sc);
+int Compute(scanner_p_t sc, seq_p_t seq, col_p_t rc, int reverse,
+	    int *maxScore);
+int ComputeBatch(scanner_p_t sc, seq_p_t *seqs, unsigned int n, col_p_t *rc,
+		 int strands, int *maxScore);
+int ComputeMax(scanner_p_t sc, seq_p_t seq, col_p_t rc, int reverse,
+	       int *maxScore);
+int ComputeStream(scanner_p_t sc, seq_p_t seq, col_p_t rc, int reverse,
+		  int *maxScore);
+int ComputeParallel(scanner_p_t *sc, unsigned int n, seq_p_t seq, col_p_t rc,
+		    int reverse, int *maxScore);
+int copy_result(col_p_t rc, const result_t *r);
+void free_results(col_p_t rc);
+
+void remove_lc(unsigned char *s);
+char *na2aa(const unsigned char *s, char *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESTSCAN_H */
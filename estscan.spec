@@ -9,6 +9,7 @@ License:        ESTScan
 URL:            http://estscan.sourceforge.net
 Source0:        http://dl.sf.net/estscan/%{name}-%{version}.tar.gz
 BuildRoot:      %{_tmppath}/%{name}-%{version}-%{release}-root-%(%{__id_u} -n)
+BuildRequires:  zlib-devel
 
 %description
 ESTScan is a program that can detect coding regions in DNA sequences, even if
@@ -57,6 +58,10 @@ install -m755 extract_mRNA ${RPM_BUILD_ROOT}%{_bindir}
 install -m755 extract_UG_EST ${RPM_BUILD_ROOT}%{_bindir}
 install -m755 prepare_data ${RPM_BUILD_ROOT}%{_bindir}
 
+mkdir -p ${RPM_BUILD_ROOT}%{_libdir} ${RPM_BUILD_ROOT}%{_includedir}
+install -m644 libestscan.a ${RPM_BUILD_ROOT}%{_libdir}
+install -m644 estscan.h ${RPM_BUILD_ROOT}%{_includedir}
+
 mkdir -p ${RPM_BUILD_ROOT}%{perl_vendorarch}
 install -m644 build_model_utils.pl ${RPM_BUILD_ROOT}%{perl_vendorarch}
 
@@ -88,6 +93,8 @@ rm -rf $RPM_BUILD_ROOT
 %{_bindir}/extract_UG_EST
 %{_bindir}/prepare_data
 %{perl_vendorarch}/build_model_utils.pl
+%{_libdir}/libestscan.a
+%{_includedir}/estscan.h
 
 
 %changelog
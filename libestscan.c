@@ -0,0 +1,4640 @@
+/* $Id$
+ *
+ * Christian Iseli, LICR ITO, Christian.Iseli@licr.org
+ *
+ * Copyright (c) 2004 Swiss Institute of Bioinformatics.  All rights reserved.
+ *
+ * Compile with -std=gnu99
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+#define HAVE_UNZ 1
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if !defined(__GNUC__) && defined(sun)
+#define inline
+#endif
+#include "estscan.h"
+
+#define BUF_SIZE 4096
+
+#define min(x, y)       ((x > y) ? (y) : (x))
+#define max(x, y)       ((x < y) ? (y) : (x))
+
+typedef struct _read_buf_t {
+  char *line;
+  unsigned int lmax;
+  unsigned int lc;
+  unsigned int ic;
+  char in[BUF_SIZE];
+} read_buf_t, *read_buf_p_t;
+
+struct _matrix {
+  signed char **m;
+  /* For order 1 matrices, byCode[code * frames + f] = m[f][code], so
+     that the states of a profile chain read consecutive scores.  */
+  int *byCode;
+  /* byIndex[index * frames + f] = m[f][index], so that the scores of all
+     frames for one index share a cache line.  */
+  signed char *byIndex;
+  char *name;
+  char *kind;
+  double CGmin;
+  double CGmax;
+  int matType;
+  unsigned int order;
+  unsigned int frames;
+  int offset;
+  /* Mapping of the compiled model file holding the score tables, or
+     NULL if they were built from a text file.  */
+  void *map;
+  size_t mapSize;
+};
+
+struct _seq_t {
+  const char *fName;
+  char *header;
+  unsigned char *seq;
+  double GC_pct;
+  /* Input, mapped when possible, or else read in blocks into dataMax
+     bytes.  The bytes from cur to size are yet to be parsed.  */
+  char *data;
+  size_t size;
+  size_t cur;
+  size_t dataMax;
+  /* Offset of data in the input, after decompression.  */
+  size_t pos;
+  int mapped;
+  int eof;
+  int fd;
+  /* Decompressing thread, for compressed input.  */
+  void *unz;
+  /* Records of mapped input whose sequence spans at least streamMin
+     bytes, if not 0, are not copied to seq: raw then points to their
+     rawLen bytes in the input, see seq_read_strand.  */
+  const char *raw;
+  size_t rawLen;
+  size_t streamMin;
+  /* Records of mapped input starting at or after this offset are not
+     read, see seq_set_range.  */
+  size_t end;
+  unsigned int len;
+  unsigned int maxHead;
+  unsigned int max;
+};
+
+/* Positions whose emission scores are computed at once, ahead of the
+   Viterbi columns which use them, by a single scan.  */
+#ifdef DEBUG
+#define EMIT_CHUNK 1
+#else
+#define EMIT_CHUNK 32
+#endif
+
+/* The three CDS states, the first stop profile state and the 3'UTR
+   state are the only ones with several possible predecessors.  */
+#define NB_BRANCH 5
+
+/* Indices of the HMM states, which depend on the shape of the chosen
+   matrices.  */
+typedef struct _layout_t {
+  int iBegin, i5utr, iStart, iCds, iStop, i3utr;
+  /* next tsize states implement insertion/deletion after nucleotide in frame index */
+  int iInsAfter[3], iDelAfter[3];
+  /* last tsize states implemented insertion/deletion before nucleotide in frame index */
+  int iInsNext[3], iDelNext[3];
+  unsigned int states;
+  int tsize, startlen, startoff, stoplen, stopoff;
+  /* Predecessor of each state, or -2 - b for the states choosing among
+     the nCand[b] candidates of branch b, with transition penalties
+     ctrans[b].  The index of the chosen candidate is kept in the
+     traceback word of each position, at bit bShift[b].  */
+  int *pred;
+  int *cand[NB_BRANCH];
+  int *ctrans[NB_BRANCH];
+  unsigned int nCand[NB_BRANCH];
+  unsigned int bShift[NB_BRANCH];
+  unsigned int bMask[NB_BRANCH];
+  /* Whether each state emits coding sequence, and its frame, or -1.  */
+  unsigned char *coding;
+  signed char *frame;
+  /* States with a predecessor of different coding status.  */
+  int *edge;
+  unsigned int nEdge;
+} layout_t, *layout_p_t;
+
+/* Coding segments on the best path to a state, see ComputeMax.  */
+typedef struct _seg_t {
+  /* The open segment, whose score is the Viterbi score minus base.  */
+  int start;
+  int base;
+  /* Best score of the closed segments.  */
+  int best;
+  /* Best closed segment longer than minLen, if lStart >= 0.  */
+  int lScore;
+  int lStart;
+  int lStop;
+} seg_t, *seg_p_t;
+
+struct _scanner_t {
+  col_p_t mc;
+  params_t p;
+  layout_t l;
+  matrix_p_t M[MT_COUNT];
+  /* Viterbi and traceback tables for the block of positions starting
+     at bStart.  A batch interleaves the columns of its lanes, and the
+     traceback follows lane.  */
+  size_t maxSize;
+  int *V;
+  unsigned int *tr;
+  unsigned int trMax;
+  unsigned int bLen;
+  unsigned int bStart;
+  unsigned int lanes;
+  unsigned int lane;
+  /* Strand being scanned, the reverse one is read in place.  */
+  int reverse;
+  /* In a narrow batch, V holds shorts and off the offset of each
+     column of each lane.  */
+  int narrow;
+  int *off;
+  unsigned int offMax;
+  /* Viterbi kernels for the shape of the matrices in M.  */
+  const struct _kernels_t *kern;
+  /* Rolling indices into the score tables.  */
+  unsigned int tableSize;
+  unsigned int tindex;
+  unsigned int *insTindex;
+  unsigned int *delTindex;
+  unsigned int maxOrder;
+  /* Viterbi column and rolling indices preceding each block.  */
+  int *ckV;
+  unsigned int *ckTindex;
+  size_t ckVMax;
+  size_t ckTMax;
+  unsigned int ckTsize;
+  /* Rolling indices and emission scores of each lane of a batch.  A
+     single scan keeps the emission scores of the next EMIT_CHUNK
+     positions in bE, one row of states per position, and their codes in
+     eCode.  */
+  unsigned int *bTindex;
+  unsigned int bTMax;
+  int *bE;
+  unsigned int bEMax;
+  unsigned char eCode[EMIT_CHUNK];
+  unsigned char eChar[EMIT_CHUNK];
+  /* Coding sequence being traced back.  */
+  unsigned char *trace;
+  size_t traceMax;
+  unsigned int *edits;
+  size_t editMax;
+  /* Path info for ComputeMax.  */
+  seg_p_t seg;
+  unsigned int segMax;
+  /* Streaming scan, see ComputeStream.  The chars and traceback words of
+     positions sKeep to sEnd are kept from sOff on, along with the
+     checkpoints of their blocks.  The best paths to all the states go
+     through state sAnchor at position sBase - 1, or else stay in the
+     5'UTR.  The results of the path through sAnchor before sBase are in
+     rc from sFirst on, their best score is sBest.  */
+  int stream;
+  unsigned char *sChar;
+  unsigned int *sTr;
+  size_t sMax;
+  unsigned int sOff;
+  unsigned int sKeep;
+  unsigned int sBase;
+  unsigned int sEnd;
+  unsigned int sCheck;
+  int sAnchor;
+  unsigned int sFirst;
+  int sBest;
+  int *sSet;
+  unsigned int sSetMax;
+  /* When sAnchor is coding, the start of its coding segment: its chars,
+     with the padding, and its edits, in order, where it starts, its
+     padding and its score, but for the Viterbi score at its end.  */
+  unsigned char *hChar;
+  size_t hLen;
+  size_t hMax;
+  unsigned int *hEdit;
+  size_t hEdits;
+  size_t hEditMax;
+  int hStart;
+  int hPad;
+  int hScore;
+  /* Parallel scan this scanner takes part in, see ComputeParallel.  */
+  void *par;
+};
+
+/* Sequences whose Viterbi and traceback tables need more bytes than this
+   are scanned with checkpoints every sqrt(length) positions, and the
+   traceback recomputes the tables one block at a time.  */
+#ifndef FULL_TABLE_MAX
+#define FULL_TABLE_MAX (64 << 20)
+#endif
+
+#ifdef __GNUC__
+/* One score per lane of a batch.  The reduced alignment allows the
+   columns to live in the plain int tables.  */
+typedef int vint_t __attribute__ ((vector_size (BATCH_LANES * sizeof(int)),
+				   aligned (sizeof(int))));
+typedef unsigned int vuint_t
+  __attribute__ ((vector_size (BATCH_LANES * sizeof(int)),
+		  aligned (sizeof(int))));
+/* The same with 16-bit scores, for a narrow batch.  It fits a 256-bit
+   register, where vint_t needs two.  __builtin_convertvector is needed
+   to go between the two widths.  */
+#if __GNUC__ >= 9
+#define HAVE_NARROW 1
+typedef short vshort_t
+  __attribute__ ((vector_size (BATCH_LANES * sizeof(short)),
+		  aligned (sizeof(short))));
+#endif
+/* A run of consecutive states of one column.  */
+#define VCOL_INTS 8
+typedef int vcol_t __attribute__ ((vector_size (VCOL_INTS * sizeof(int)),
+				   aligned (sizeof(int)), may_alias));
+#endif
+
+/* The vector kernels are built for several instruction sets, the best
+   one for the CPU is picked when the program starts.  */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(NO_TARGET_CLONES)
+#define SIMD_CLONES \
+  __attribute__ ((target_clones ("avx512f", "avx2", "sse4.1", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+/* Kernel helpers are inlined into each of their specialized callers.  */
+#ifdef __GNUC__
+#define ALWAYS_INLINE __attribute__ ((always_inline))
+#else
+#define ALWAYS_INLINE
+#endif
+
+/* Message of the last error of each thread, see es_error.  */
+#define ERR_SIZE 512
+#ifdef __GNUC__
+static __thread char errMsg[ERR_SIZE];
+#else
+static char errMsg[ERR_SIZE];
+#endif
+
+static const unsigned char dna_complement[256] =
+  "                                                                "
+  " TVGH  CD  M KN   YSA BWXR       tvgh  cd  m kn   ysa bwxr      "
+  "                                                                "
+  "                                                                ";
+/* ................................................................ */
+/* @ABCDEFGHIJKLMNOPQRSTUVWXYZ[\]^_`abcdefghijklmnopqrstuvwxyz{|}~. */
+/* ................................................................ */
+/* ................................................................ */
+
+/* Letters kept in sequences, upper cased, and space for the others.  */
+static const unsigned char dna_upper[256] =
+  "                                                                "
+  " ABCDEFGHIJKLMNOPQRSTUVWXYZ      ABCDEFGHIJKLMNOPQRSTUVWXYZ     "
+  "                                                                "
+  "                                                                ";
+
+/* Code of each upper case nucleotide, A C G T as 0 to 3, else 4.  */
+static const unsigned char dna_code[256] = {
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 0, 4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4
+};
+
+/* Amino acid of each codon, indexed by the codes of its nucleotides in
+   base 5, and O for stop codons.  */
+static const char codon_aa[125] =
+  "KNKNXTTTTTRSRSXIIMIXXXXXX"	/* AAA AAC ... ANN */
+  "QHQHXPPPPPRRRRRLLLLLXXXXX"	/* CAA CAC ... CNN */
+  "EDEDXAAAAAGGGGGVVVVVXXXXX"	/* GAA GAC ... GNN */
+  "OYOYXSSSSSOCWCXLFLFXXXXXX"	/* TAA TAC ... TNN */
+  "XXXXXXXXXXXXXXXXXXXXXXXXX";	/* NAA NAC ... NNN */
+
+/* Size of the blocks read from inputs which cannot be mapped.  */
+#define READ_BLOCK (1 << 20)
+
+/* Keep the message of an error for es_error, and return -1.  */
+#ifdef __GNUC__
+static int failed(const char *fmt, ...)
+     __attribute__ ((format (printf, 1, 2)));
+#endif
+
+static int
+failed(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(errMsg, sizeof(errMsg), fmt, ap);
+  va_end(ap);
+#ifdef DEBUG
+  fputs(errMsg, stderr);
+#endif
+  return -1;
+}
+
+/* Why the last library call of the calling thread which returned -1,
+   or NULL, failed.  */
+const char *
+es_error(void)
+{
+  return errMsg;
+}
+
+static int
+intCompare(const void *a, const void *b)
+{
+  int ia = * (int *) a;
+  int ib = * (int *) b;
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/* malloc, which keeps the error when it fails.  */
+static void *
+allocate(size_t size)
+{
+  void *res = malloc(size);
+  if (res == NULL)
+    failed("malloc of %zd failed: %s (%d)\n", size, strerror(errno),
+	   errno);
+  return res;
+}
+
+/* Resize the block pointed to by *(void **) ptr to size bytes.  It is
+   left as it was if that fails.  */
+static int
+resize(void *ptr, size_t size)
+{
+  void *p, *res;
+  memcpy(&p, ptr, sizeof(void *));
+  res = realloc(p, size);
+  if (res == NULL)
+    return failed("realloc of %p to %zd failed: %s (%d)\n", p, size,
+		  strerror(errno), errno);
+  memcpy(ptr, &res, sizeof(void *));
+  return 0;
+}
+
+/* Move the next line of the input of b to its line, and return 1, or
+   else 0 when more input is needed, or -1 on error.  */
+static int
+shuffle_line(read_buf_p_t b, size_t *cur)
+{
+  if (b->ic == 0 || *cur >= b->ic)
+    return 0;
+  /* Make sure we have enough room in line.  */
+  if (b->lmax <= b->lc + (b->ic - *cur)) {
+    if (resize(&b->line, 2 * b->lmax * sizeof(char)) != 0)
+      return -1;
+    b->lmax *= 2;
+  }
+  while (*cur < b->ic && b->in[*cur] != '\n')
+    b->line[b->lc++] = b->in[(*cur)++];
+  if (*cur < b->ic) {
+    /* Ok, we have our string.  */
+    /* Copy the newline.  */
+    b->line[b->lc++] = b->in[(*cur)++];
+    /* We should be fine, since we read BUF_SIZE -1 at most...  */
+    b->line[b->lc] = 0;
+    /* Adjust the input buffer.  */
+    if (*cur < b->ic) {
+      memmove(b->in, b->in + *cur, (b->ic - *cur) * sizeof(char));
+      b->ic -= *cur;
+    } else
+      b->ic = 0;
+    *cur = 0;
+    return 1;
+  }
+  /* Go read some more.  */
+  b->ic = 0, *cur = 0;
+  return 0;
+}
+
+/* Next line of fd, empty at its end, or NULL on error.  */
+static char *
+read_line_buf(read_buf_p_t b, int fd)
+{
+  ssize_t rc;
+  size_t cur = 0;
+  int res;
+  b->lc = 0;
+  if ((res = shuffle_line(b, &cur)) != 0)
+    return res > 0 ? b->line : NULL;
+  do {
+    if ((rc = read(fd, b->in + b->ic, BUF_SIZE - b->ic - 1)) == -1) {
+      if (errno != EINTR) {
+	failed("Could not read from %d: %s(%d)\n",
+	       fd, strerror(errno), errno);
+	return NULL;
+      }
+    } else
+      b->ic += rc;
+    if ((res = shuffle_line(b, &cur)) < 0)
+      return NULL;
+    if (res == 0 && rc == 0) {
+      /* Got to the EOF...  */
+      b->line[b->lc] = 0;
+      res = 1;
+    }
+  } while (res == 0);
+  return b->line;
+}
+
+static int
+init_buf(read_buf_p_t b)
+{
+  b->line = allocate(BUF_SIZE * sizeof(char));
+  if (b->line == NULL)
+    return -1;
+  b->lmax = BUF_SIZE;
+  b->lc = 0;
+  b->ic = 0;
+  return 0;
+}
+
+static void
+free_buf(read_buf_p_t b)
+{
+  free(b->line);
+}
+
+#ifdef HAVE_UNZ
+/* Compressed input is decompressed by a thread of its own, into a ring
+   of UNZ_CHUNKS chunks which read_block copies from.  */
+#define UNZ_CHUNK (256 << 10)
+#define UNZ_CHUNKS 4
+#define UNZ_GZIP 1
+#define UNZ_ZSTD 2
+
+typedef struct _unz_t {
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int kind;
+  /* Compressed input, the mapped file, or a buffer refilled from fd.  */
+  unsigned char *in;
+  size_t inSize;
+  size_t inMax;
+  int mapped;
+  int fd;
+  int inEof;
+  const char *fName;
+  /* Chunks [tail, head) hold decompressed data, the one at tail from
+     offset off.  */
+  unsigned char *chunk[UNZ_CHUNKS];
+  size_t len[UNZ_CHUNKS];
+  unsigned long head;
+  unsigned long tail;
+  size_t off;
+  int done;
+  int stop;
+  /* Why decompression stopped before the end, if it did.  */
+  char err[ERR_SIZE];
+} unz_t, *unz_p_t;
+
+/* Refill the compressed input of u, returning 0 at its end, or -1 on
+   error.  */
+static ssize_t
+unz_fill(unz_p_t u)
+{
+  ssize_t rc;
+  if (u->mapped || u->inEof)
+    return 0;
+  while ((rc = read(u->fd, u->in, u->inMax)) == -1)
+    if (errno != EINTR)
+      return failed("Could not read from %d: %s(%d)\n", u->fd,
+		    strerror(errno), errno);
+  if (rc == 0)
+    u->inEof = 1;
+  return u->inSize = rc;
+}
+
+/* Wait for a free chunk, and return it, or NULL if the reader is gone.  */
+static unsigned char *
+unz_chunk(unz_p_t u)
+{
+  unsigned char *c = NULL;
+  pthread_mutex_lock(&u->lock);
+  while (!u->stop && u->head - u->tail == UNZ_CHUNKS)
+    pthread_cond_wait(&u->cond, &u->lock);
+  if (!u->stop)
+    c = u->chunk[u->head % UNZ_CHUNKS];
+  pthread_mutex_unlock(&u->lock);
+  return c;
+}
+
+/* Hand the chunk being filled over to the reader, with len bytes.  */
+static void
+unz_push(unz_p_t u, size_t len)
+{
+  pthread_mutex_lock(&u->lock);
+  u->len[u->head % UNZ_CHUNKS] = len;
+  u->head += 1;
+  pthread_cond_broadcast(&u->cond);
+  pthread_mutex_unlock(&u->lock);
+}
+
+#ifdef HAVE_ZLIB
+/* Inflate gzip members one after the other, as zcat does.  */
+static int
+unz_gzip(unz_p_t u)
+{
+  z_stream z;
+  unsigned char *out;
+  ssize_t rc = 0;
+  int res = Z_OK;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, 15 + 32) != Z_OK)
+    return failed("Could not initialize zlib for %s\n", u->fName);
+  z.next_in = u->in;
+  z.avail_in = u->inSize;
+  while ((out = unz_chunk(u)) != NULL) {
+    z.next_out = out;
+    z.avail_out = UNZ_CHUNK;
+    while (z.avail_out > 0) {
+      if (z.avail_in == 0) {
+	if ((rc = unz_fill(u)) <= 0)
+	  break;
+	z.next_in = u->in;
+	z.avail_in = rc;
+      }
+      res = inflate(&z, Z_NO_FLUSH);
+      if (res == Z_STREAM_END) {
+	/* Another member may follow.  */
+	if (z.avail_in == 0) {
+	  if ((rc = unz_fill(u)) <= 0)
+	    break;
+	  z.next_in = u->in;
+	  z.avail_in = rc;
+	}
+	inflateReset(&z);
+      } else if (res != Z_OK) {
+	rc = failed("Bad compressed data in %s: %s\n", u->fName,
+		    z.msg != NULL ? z.msg : "zlib error");
+	break;
+      }
+    }
+    if (rc < 0)
+      break;
+    unz_push(u, UNZ_CHUNK - z.avail_out);
+    if (z.avail_out > 0)
+      break;
+  }
+  inflateEnd(&z);
+  if (rc < 0)
+    return -1;
+  if (out != NULL && res != Z_STREAM_END)
+    return failed("Truncated compressed data in %s\n", u->fName);
+  return 0;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/* Decompress zstd frames one after the other.  */
+static int
+unz_zstd(unz_p_t u)
+{
+  ZSTD_DStream *z = ZSTD_createDStream();
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  ssize_t rc = 0;
+  size_t res = 0;
+  if (z == NULL || ZSTD_isError(ZSTD_initDStream(z))) {
+    ZSTD_freeDStream(z);
+    return failed("Could not initialize zstd for %s\n", u->fName);
+  }
+  in.src = u->in;
+  in.size = u->inSize;
+  in.pos = 0;
+  while ((out.dst = unz_chunk(u)) != NULL) {
+    out.size = UNZ_CHUNK;
+    out.pos = 0;
+    while (out.pos < out.size) {
+      if (in.pos == in.size) {
+	if ((rc = unz_fill(u)) <= 0)
+	  break;
+	in.size = rc;
+	in.pos = 0;
+      }
+      res = ZSTD_decompressStream(z, &out, &in);
+      if (ZSTD_isError(res)) {
+	rc = failed("Bad compressed data in %s: %s\n", u->fName,
+		    ZSTD_getErrorName(res));
+	break;
+      }
+    }
+    if (rc < 0)
+      break;
+    unz_push(u, out.pos);
+    if (out.pos < out.size)
+      break;
+  }
+  ZSTD_freeDStream(z);
+  if (rc < 0)
+    return -1;
+  if (out.dst != NULL && res != 0)
+    return failed("Truncated compressed data in %s\n", u->fName);
+  return 0;
+}
+#endif
+
+static void *
+unz_thread(void *arg)
+{
+  unz_p_t u = (unz_p_t) arg;
+  int res = 0;
+#ifdef HAVE_ZLIB
+  if (u->kind == UNZ_GZIP)
+    res = unz_gzip(u);
+#endif
+#ifdef HAVE_ZSTD
+  if (u->kind == UNZ_ZSTD)
+    res = unz_zstd(u);
+#endif
+  pthread_mutex_lock(&u->lock);
+  /* The message is kept by this thread, the reader gets a copy.  */
+  if (res != 0)
+    memcpy(u->err, errMsg, ERR_SIZE);
+  u->done = 1;
+  pthread_cond_broadcast(&u->cond);
+  pthread_mutex_unlock(&u->lock);
+  return NULL;
+}
+
+/* Copy up to n bytes of decompressed data to buf, 0 at the end, or -1
+   once those decompressed before an error are read.  */
+static ssize_t
+unz_read(unz_p_t u, char *buf, size_t n)
+{
+  size_t done = 0;
+  pthread_mutex_lock(&u->lock);
+  while (u->head == u->tail && !u->done)
+    pthread_cond_wait(&u->cond, &u->lock);
+  if (u->head == u->tail && u->err[0] != 0) {
+    pthread_mutex_unlock(&u->lock);
+    return failed("%s", u->err);
+  }
+  while (done < n && u->head != u->tail) {
+    unsigned int i = u->tail % UNZ_CHUNKS;
+    size_t len = min(n - done, u->len[i] - u->off);
+    /* The chunk at tail is not written while it is in the ring.  */
+    memcpy(buf + done, u->chunk[i] + u->off, len);
+    done += len;
+    u->off += len;
+    if (u->off == u->len[i]) {
+      u->tail += 1;
+      u->off = 0;
+      pthread_cond_broadcast(&u->cond);
+    }
+  }
+  pthread_mutex_unlock(&u->lock);
+  return done;
+}
+
+/* Hand the input of sp, which starts with the magic bytes of kind, over
+   to a decompressing thread.  */
+static int
+unz_start(seq_p_t sp, int kind)
+{
+  unz_p_t u = (unz_p_t) allocate(sizeof(unz_t));
+  unsigned int i;
+  if (u == NULL)
+    return -1;
+  u->kind = kind;
+  u->mapped = sp->mapped;
+  u->fd = sp->fd;
+  u->inEof = sp->eof;
+  u->fName = sp->fName != NULL ? sp->fName : "stdin";
+  u->in = (unsigned char *) sp->data;
+  u->inSize = sp->size;
+  u->inMax = sp->dataMax;
+  for (i = 0; i < UNZ_CHUNKS; i++)
+    u->chunk[i] = (unsigned char *) malloc(UNZ_CHUNK);
+  u->head = u->tail = 0;
+  u->off = 0;
+  u->done = u->stop = 0;
+  u->err[0] = 0;
+  pthread_mutex_init(&u->lock, NULL);
+  pthread_cond_init(&u->cond, NULL);
+  for (i = 0; i < UNZ_CHUNKS && u->chunk[i] != NULL; i++)
+    ;
+  if (i < UNZ_CHUNKS)
+    failed("malloc of %d failed: %s (%d)\n", UNZ_CHUNK, strerror(errno),
+	   errno);
+  else if ((errno = pthread_create(&u->tid, NULL, unz_thread, u)) != 0)
+    failed("Could not create thread: %s(%d)\n", strerror(errno), errno);
+  else {
+    sp->data = NULL;
+    sp->size = sp->cur = sp->dataMax = 0;
+    sp->mapped = sp->eof = 0;
+    sp->unz = u;
+    return 0;
+  }
+  pthread_mutex_destroy(&u->lock);
+  pthread_cond_destroy(&u->cond);
+  for (i = 0; i < UNZ_CHUNKS; i++)
+    free(u->chunk[i]);
+  free(u);
+  return -1;
+}
+
+static void
+unz_free(unz_p_t u)
+{
+  unsigned int i;
+  pthread_mutex_lock(&u->lock);
+  u->stop = 1;
+  pthread_cond_broadcast(&u->cond);
+  pthread_mutex_unlock(&u->lock);
+  pthread_join(u->tid, NULL);
+  pthread_mutex_destroy(&u->lock);
+  pthread_cond_destroy(&u->cond);
+  for (i = 0; i < UNZ_CHUNKS; i++)
+    free(u->chunk[i]);
+  if (u->mapped)
+    munmap(u->in, u->inSize);
+  else
+    free(u->in);
+  free(u);
+}
+#endif
+
+/* Read the next block of an input which is not mapped.  The unread
+   bytes are first moved to the start of the buffer, which grows when
+   they fill more than half of it.  */
+static int
+read_block(seq_p_t sp)
+{
+  size_t left = sp->size - sp->cur;
+  ssize_t rc;
+  if (sp->cur > 0) {
+    memmove(sp->data, sp->data + sp->cur, left);
+    sp->pos += sp->cur;
+    sp->cur = 0;
+    sp->size = left;
+  }
+  if (sp->dataMax - sp->size < READ_BLOCK) {
+    size_t dataMax = max(2 * sp->dataMax, sp->size + READ_BLOCK);
+    if (resize(&sp->data, dataMax) != 0)
+      return -1;
+    sp->dataMax = dataMax;
+  }
+#ifdef HAVE_UNZ
+  if (sp->unz != NULL)
+    rc = unz_read((unz_p_t) sp->unz, sp->data + sp->size,
+		  sp->dataMax - sp->size);
+  else
+#endif
+  while ((rc = read(sp->fd, sp->data + sp->size, sp->dataMax - sp->size))
+	 == -1)
+    if (errno != EINTR)
+      return failed("Could not read from %d: %s(%d)\n", sp->fd,
+		    strerror(errno), errno);
+  if (rc < 0)
+    return -1;
+  if (rc == 0)
+    sp->eof = 1;
+  sp->size += rc;
+  return 0;
+}
+
+static void free_seq(seq_p_t sp);
+
+/* Open fName, or stdin if NULL, for get_next_seq.  sp need not be freed
+   if this fails.  */
+static int
+init_seq(const char *fName, seq_p_t sp)
+{
+  struct stat st;
+  sp->fName = fName;
+  sp->header = NULL;
+  sp->seq = NULL;
+  if (fName != NULL) {
+    sp->fd = open(fName, O_RDONLY);
+    if (sp->fd == -1)
+      return failed("Could not open file %s: %s(%d)\n",
+		    fName, strerror(errno), errno);
+  } else
+    sp->fd = 0;
+  sp->len = 0;
+  sp->maxHead = 0;
+  sp->max = 0;
+  sp->data = NULL;
+  sp->size = 0;
+  sp->cur = 0;
+  sp->dataMax = 0;
+  sp->pos = 0;
+  sp->mapped = 0;
+  sp->eof = 0;
+  sp->raw = NULL;
+  sp->rawLen = 0;
+  sp->streamMin = 0;
+  sp->end = SIZE_MAX;
+  /* Map regular files, unless already partly read.  */
+  if (fstat(sp->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+      && lseek(sp->fd, 0, SEEK_CUR) == 0) {
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, sp->fd, 0);
+    if (p != MAP_FAILED) {
+      madvise(p, st.st_size, MADV_SEQUENTIAL);
+      sp->data = (char *) p;
+      sp->size = st.st_size;
+      sp->mapped = 1;
+      sp->eof = 1;
+    }
+  }
+  sp->unz = NULL;
+  /* Compressed inputs are told by their magic number, and refused if
+     this build cannot read them.  */
+  while (sp->size < 4 && !sp->eof)
+    if (read_block(sp) != 0) {
+      free_seq(sp);
+      return -1;
+    }
+  if (sp->size >= 2 && (unsigned char) sp->data[0] == 0x1f
+      && (unsigned char) sp->data[1] == 0x8b) {
+#ifdef HAVE_ZLIB
+    if (unz_start(sp, UNZ_GZIP) != 0) {
+      free_seq(sp);
+      return -1;
+    }
+#else
+    failed("Cannot read %s, gzip compressed, not built with zlib "
+	   "support\n", fName != NULL ? fName : "stdin");
+    free_seq(sp);
+    return -1;
+#endif
+  } else if (sp->size >= 4
+	     && memcmp(sp->data, "\x28\xb5\x2f\xfd", 4) == 0) {
+#ifdef HAVE_ZSTD
+    if (unz_start(sp, UNZ_ZSTD) != 0) {
+      free_seq(sp);
+      return -1;
+    }
+#else
+    failed("Cannot read %s, zstd compressed, not built with zstd "
+	   "support\n", fName != NULL ? fName : "stdin");
+    free_seq(sp);
+    return -1;
+#endif
+  }
+  return 0;
+}
+
+/* Set *line to the next line of input, with its newline if any, *len
+   bytes long, or to NULL at the end of input.  The line is valid until
+   the next call, and is consumed by moving sp->cur past it.  Returns -1
+   on error, else 0.  */
+static int
+peek_line(seq_p_t sp, const char **line, size_t *len)
+{
+  size_t seen = 0;
+  const char *nl;
+  while ((nl = sp->cur + seen < sp->size
+	       ? memchr(sp->data + sp->cur + seen, '\n',
+			sp->size - sp->cur - seen)
+	       : NULL) == NULL && !sp->eof) {
+    seen = sp->size - sp->cur;
+    if (read_block(sp) != 0)
+      return -1;
+  }
+  *line = sp->data + sp->cur;
+  if (nl != NULL)
+    *len = nl + 1 - (sp->data + sp->cur);
+  else if ((*len = sp->size - sp->cur) == 0)
+    *line = NULL;
+  return 0;
+}
+
+/* Only read the records of the mapped input of sp whose header starts
+   in the bytes from start to end: skip to the first line starting at or
+   after start.  */
+int
+seq_set_range(seq_p_t sp, size_t start, size_t end)
+{
+  struct stat st;
+  if (!sp->mapped) {
+    /* Empty files are not mapped.  */
+    if (sp->unz == NULL && fstat(sp->fd, &st) == 0 && S_ISREG(st.st_mode)
+	&& st.st_size == 0)
+      return 0;
+    return failed("Byte ranges need an uncompressed regular file: %s\n",
+		  sp->fName != NULL ? sp->fName : "stdin");
+  }
+  start = min(start, sp->size);
+  if (start > 0 && sp->data[start - 1] != '\n') {
+    const char *nl = memchr(sp->data + start, '\n', sp->size - start);
+    start = nl != NULL ? (size_t) (nl + 1 - sp->data) : sp->size;
+  }
+  sp->cur = start;
+  sp->end = end;
+  return 0;
+}
+
+/* Only read the record of the mapped input of sp whose sequence starts
+   at offset, as found in an index, next.  */
+int
+seq_seek_record(seq_p_t sp, size_t offset)
+{
+  size_t h = min(offset, sp->size);
+  if (!sp->mapped)
+    return failed("Indexed records need an uncompressed regular file: %s\n",
+		  sp->fName != NULL ? sp->fName : "stdin");
+  /* The records are read out of order from now on.  */
+  if (sp->end == SIZE_MAX)
+    madvise(sp->data, sp->size, MADV_RANDOM);
+  /* The header is the line before the sequence.  */
+  if (h > 0)
+    h -= 1;
+  while (h > 0 && sp->data[h - 1] != '\n')
+    h -= 1;
+  if (h == sp->size || sp->data[h] != '>')
+    return failed("No record at offset %zu of %s, is its index out of "
+		  "date?\n", offset, sp->fName != NULL ? sp->fName : "stdin");
+  sp->cur = h;
+  sp->end = h + 1;
+  return 0;
+}
+
+/* Offset of the next record of sp in its input, after decompression.  */
+size_t
+seq_tell(const seq_t *sp)
+{
+  return sp->pos + sp->cur;
+}
+
+/* Skip the input of sp up to offset, as returned by seq_tell.  */
+int
+seq_seek(seq_p_t sp, size_t offset)
+{
+  while (sp->pos + sp->size < offset && !sp->eof) {
+    sp->cur = sp->size;
+    if (read_block(sp) != 0)
+      return -1;
+  }
+  sp->cur = offset > sp->pos ? min(offset - sp->pos, sp->size) : 0;
+  return 0;
+}
+
+/* Consume the next line of input, see peek_line.  */
+int
+seq_next_line(seq_p_t sp, const char **line, size_t *len)
+{
+  if (peek_line(sp, line, len) != 0)
+    return -1;
+  if (*line != NULL)
+    sp->cur += *len;
+  return 0;
+}
+
+/* Leave the sequence of the record at sp->cur in the mapped input, if
+   it spans at least streamMin bytes and holds no NUL, and count its
+   letters in ctr.  Returns whether it did, or -1 on error.  */
+static int
+stream_record(seq_p_t sp, unsigned int *ctr)
+{
+  const char *s = sp->data + sp->cur;
+  const char *end = sp->data + sp->size;
+  const char *e = memchr(s, '>', end - s);
+  size_t len = 0;
+  /* The record ends with the next line starting with '>'.  */
+  while (e != NULL && e != s && e[-1] != '\n')
+    e = memchr(e + 1, '>', end - e - 1);
+  if (e == NULL)
+    e = end;
+  if ((size_t) (e - s) < sp->streamMin || memchr(s, 0, e - s) != NULL)
+    return 0;
+  for ( ; s < e; s++) {
+    unsigned char c = dna_upper[(unsigned char) *s];
+    if (c != ' ') {
+      ctr[c] += 1;
+      len += 1;
+    }
+  }
+  if (len >= UINT_MAX)
+    return failed("Sequence too long: %zu\n", len);
+  sp->raw = sp->data + sp->cur;
+  sp->rawLen = e - sp->raw;
+  sp->len = len;
+  sp->cur = e - sp->data;
+  return 1;
+}
+
+/* Read the next record of sp.  Returns 0, or 1 at the end of input, or
+   -1 on error.  */
+int
+get_next_seq(seq_p_t sp)
+{
+  const int lenStr = 24;
+  unsigned int headerLen;
+  const char *line;
+  char *buf;
+  size_t lc;
+  int res;
+  unsigned int ctr[256], gc, atgc;
+  ctr['A'] = ctr['C'] = ctr['G'] = ctr['T'] = 0;
+  while ((res = peek_line(sp, &line, &lc)) == 0 && line != NULL
+	 && line[0] != '>')
+    sp->cur += lc;
+  if (res != 0)
+    return -1;
+  if (line == NULL || sp->cur >= sp->end)
+    return 1;
+  /* We have the FASTA header.  */
+  if (lc + lenStr + 1 > sp->maxHead) {
+    if (resize(&sp->header, (lc + lenStr + 1) * sizeof(char)) != 0)
+      return -1;
+    sp->maxHead = lc + lenStr + 1;
+  }
+  headerLen = lc;
+  memcpy(sp->header, line, lc * sizeof(char));
+  sp->header[lc] = 0;
+  sp->cur += lc;
+  sp->len = 0;
+  sp->raw = NULL;
+  if (sp->mapped && sp->streamMin > 0
+      && (res = stream_record(sp, ctr)) != 0) {
+    if (res < 0)
+      return -1;
+  } else {
+    while ((res = peek_line(sp, &line, &lc)) == 0 && line != NULL
+	   && line[0] != '>') {
+      size_t i;
+      /* Make sure we have enough room for this additional line.  */
+      if (sp->len + lc + 1 > sp->max) {
+	size_t m = max(sp->len + lc + 1, 2 * (size_t) sp->max);
+	if (resize(&sp->seq, m * sizeof(unsigned char)) != 0)
+	  return -1;
+	sp->max = m;
+      }
+      /* Keep the letters, up to a NUL.  */
+      for (i = 0; i < lc; i++) {
+	unsigned char c = dna_upper[(unsigned char) line[i]];
+	if (c != ' ') {
+	  ctr[c] += 1;
+	  sp->seq[sp->len++] = c;
+	} else if (line[i] == 0)
+	  break;
+      }
+      sp->cur += lc;
+    }
+    if (res != 0)
+      return -1;
+    if (sp->len + 1 > sp->max) {
+      if (resize(&sp->seq, (sp->len + 0x40000) * sizeof(unsigned char)) != 0)
+	return -1;
+      sp->max = sp->len + 0x40000;
+    }
+    sp->seq[sp->len] = 0;
+  }
+  buf = strstr(sp->header, " LEN=");
+  if (buf) {
+    char *s;
+    if (*(buf - 1) == ';') {
+      buf -= 1;
+      s = buf + 6;
+      headerLen -= 6;
+    } else {
+      s = buf + 5;
+      headerLen -= 5;
+    }
+    while (isdigit(*s)) {
+      s += 1;
+      headerLen -= 1;
+    }
+    while (*s)
+      *buf++ = *s++;
+  }
+  buf = sp->header + headerLen - 1;
+  while (iscntrl(*buf) || isspace(*buf))
+    buf -= 1;
+  res = snprintf(buf + 1, lenStr, "; LEN=%u\n", sp->len);
+  if (res < 0 || res >= lenStr)
+    return failed("Sequence too long: %u\n", sp->len);
+  gc = ctr['G'] + ctr['C'];
+  atgc = gc + ctr['A'] + ctr['T'];
+  sp->GC_pct = (atgc == 0) ? 0.0 : 100.0 * (double) gc / (double) atgc;
+  return 0;
+}
+
+static void
+free_seq(seq_p_t sp)
+{
+  free(sp->seq);
+  free(sp->header);
+#ifdef HAVE_UNZ
+  if (sp->unz != NULL)
+    unz_free((unz_p_t) sp->unz);
+#endif
+  if (sp->mapped)
+    munmap(sp->data, sp->size);
+  else
+    free(sp->data);
+  if (sp->fName != NULL)
+    close(sp->fd);
+}
+
+/* Open fName, or stdin if NULL, to read its records with
+   get_next_seq.  */
+seq_p_t
+es_seq_open(const char *fName)
+{
+  seq_p_t sp = (seq_p_t) allocate(sizeof(seq_t));
+  if (sp != NULL && init_seq(fName, sp) != 0) {
+    free(sp);
+    return NULL;
+  }
+  return sp;
+}
+
+/* A record without input, to hold those moved from others by
+   es_seq_swap.  */
+seq_p_t
+es_seq_new(void)
+{
+  seq_p_t sp = (seq_p_t) allocate(sizeof(seq_t));
+  if (sp != NULL) {
+    memset(sp, 0, sizeof(seq_t));
+    sp->fd = -1;
+    sp->eof = 1;
+    sp->end = SIZE_MAX;
+  }
+  return sp;
+}
+
+void
+es_seq_close(seq_p_t sp)
+{
+  if (sp != NULL) {
+    free_seq(sp);
+    free(sp);
+  }
+}
+
+/* Header line of the current record, without its newline.  */
+const char *
+es_seq_header(const seq_t *sp)
+{
+  return sp->header;
+}
+
+unsigned int
+es_seq_len(const seq_t *sp)
+{
+  return sp->len;
+}
+
+double
+es_seq_GC_pct(const seq_t *sp)
+{
+  return sp->GC_pct;
+}
+
+/* Upper case sequence of the current record, or NULL if it was left in
+   the input, see es_seq_stream.  */
+const unsigned char *
+es_seq_data(const seq_t *sp)
+{
+  return sp->raw != NULL ? NULL : sp->seq;
+}
+
+/* Size of the input of sp when it is mapped, and so may be read in byte
+   ranges, or else 0.  */
+size_t
+es_seq_size(const seq_t *sp)
+{
+  return sp->mapped ? sp->size : 0;
+}
+
+/* Leave the sequences of mapped input spanning at least streamMin bytes
+   in it, for ComputeStream, or none if 0.  */
+void
+es_seq_stream(seq_p_t sp, size_t streamMin)
+{
+  sp->streamMin = streamMin;
+}
+
+/* Move the current record of src to dst, which gets its buffers in
+   exchange for those of dst, so that no copy is needed.  */
+void
+es_seq_swap(seq_p_t dst, seq_p_t src)
+{
+  char *header = dst->header;
+  unsigned char *sq = dst->seq;
+  unsigned int maxHead = dst->maxHead;
+  unsigned int max = dst->max;
+  dst->header = src->header;
+  dst->seq = src->seq;
+  dst->maxHead = src->maxHead;
+  dst->max = src->max;
+  dst->len = src->len;
+  dst->GC_pct = src->GC_pct;
+  dst->raw = src->raw;
+  dst->rawLen = src->rawLen;
+  src->header = header;
+  src->seq = sq;
+  src->maxHead = maxHead;
+  src->max = max;
+}
+
+void
+seq_revcomp_inplace(seq_p_t seq)
+{
+  unsigned char *s = seq->seq;
+  unsigned char *t = seq->seq + seq->len;
+  unsigned char c;
+  while (s < t) {
+    c = dna_complement[*--t];
+    *t = dna_complement[*s];
+    *s++ = c;
+  }
+}
+
+/* Write the reverse complement of seq to dst.  Returns 0 if some letter
+   of seq is not the complement of its complement, in which case dst is
+   not enough to get seq back.  */
+int
+seq_revcomp_copy(const seq_t *seq, unsigned char *dst)
+{
+  const unsigned char *s = seq->seq + seq->len;
+  int res = 1;
+  while (s > seq->seq) {
+    unsigned char c = *--s;
+    *dst = dna_complement[c];
+    if (dna_complement[*dst++] != c)
+      res = 0;
+  }
+  return res;
+}
+
+/* Copy the next letters of the given strand of seq to dst, up to n of
+   them, and return how many.  *at counts the bytes of the record read
+   so far, from its end for the reverse strand, and is moved past those
+   read.  The sequence is read from the input when it was left there,
+   see stream_record.  */
+unsigned int
+seq_read_strand(const seq_t *seq, int reverse, size_t *at,
+		unsigned char *dst, unsigned int n)
+{
+  const unsigned char *s = seq->raw != NULL
+			   ? (const unsigned char *) seq->raw : seq->seq;
+  size_t size = seq->raw != NULL ? seq->rawLen : seq->len;
+  size_t i = *at;
+  unsigned int k = 0;
+  if (reverse)
+    while (k < n && i < size) {
+      unsigned char c = dna_upper[s[size - 1 - i++]];
+      if (c != ' ')
+	dst[k++] = dna_complement[c];
+    }
+  else
+    while (k < n && i < size) {
+      unsigned char c = dna_upper[s[i++]];
+      if (c != ' ')
+	dst[k++] = c;
+    }
+  *at = i;
+  return k;
+}
+
+/* Copy n chars of the given strand of seq, from pos on, to dst in lower
+   case.  The reverse strand is read through the complement.  */
+void
+seq_strand_lower(const seq_t *seq, int reverse, unsigned int pos,
+		 unsigned int n, char *dst)
+{
+  unsigned int i;
+  if (reverse) {
+    const unsigned char *s = seq->seq + seq->len - 1 - pos;
+    for (i = 0; i < n; i++)
+      dst[i] = tolower(dna_complement[*s--]);
+  } else
+    for (i = 0; i < n; i++)
+      dst[i] = tolower(seq->seq[pos + i]);
+}
+
+int
+init_col(col_p_t c, unsigned int size)
+{
+  c->size = 0;
+  c->nb = 0;
+  c->arena = NULL;
+  c->e.elt = NULL;
+  if (size > 0
+      && (c->e.elt = (void **) allocate(size * sizeof(void *))) == NULL)
+    return -1;
+  c->size = size;
+  return 0;
+}
+
+int
+add_col_elt(col_p_t c, void *elt, unsigned int grow)
+{
+  if (c->size <= c->nb) {
+    if (resize(&c->e.elt, (c->size + grow) * sizeof(void *)) != 0)
+      return -1;
+    c->size += grow;
+  }
+  c->e.elt[c->nb++] = elt;
+  return 0;
+}
+
+#if 0 /* CI */
+static void
+add_unique_col_elt(col_p_t c, void *elt, unsigned int grow)
+{
+  unsigned int i;
+  for (i = 0; i < c->nb; i++)
+    if (c->e.elt[i] == elt)
+      return;
+  add_col_elt(c, elt, grow);
+}
+
+static void
+merge_col(col_p_t c1, col_p_t c2)
+{
+  unsigned int i;
+  for (i = 0; i < c2->nb; i++)
+    add_col_elt(c1, c2->e.elt[i], COL_G_GROW);
+}
+#endif /* 0 CI */
+
+void
+free_col(col_p_t c)
+{
+#ifndef NDEBUG
+  memset(c->e.elt, 0, c->size * sizeof(void *));
+#endif
+  free(c->e.elt);
+#ifndef NDEBUG
+  memset(c, 0, sizeof(col_t));
+#endif
+}
+
+/* Size of the arena blocks, and alignment of what is allocated in
+   them.  */
+#define ARENA_BLOCK 65536
+#define ARENA_ALIGN 16
+#define ARENA_HEAD ((sizeof(arena_blk_t) + ARENA_ALIGN - 1) \
+		    & ~(size_t) (ARENA_ALIGN - 1))
+
+void
+init_arena(arena_p_t a)
+{
+  a->first = NULL;
+  a->cur = NULL;
+}
+
+void *
+arena_alloc(arena_p_t a, size_t size)
+{
+  arena_blk_p_t b = a->cur;
+  void *p;
+  size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+  /* Blocks after cur are free, but may be too small.  */
+  while (b != NULL && b->used + size > b->size) {
+    if (b->next == NULL)
+      break;
+    b = b->next;
+  }
+  if (b == NULL || b->used + size > b->size) {
+    size_t bSize = max(size, ARENA_BLOCK);
+    arena_blk_p_t n = (arena_blk_p_t) allocate(ARENA_HEAD + bSize);
+    if (n == NULL)
+      return NULL;
+    n->next = NULL;
+    n->size = bSize;
+    n->used = 0;
+    if (b == NULL)
+      a->first = n;
+    else
+      b->next = n;
+    b = n;
+  }
+  a->cur = b;
+  p = (char *) b + ARENA_HEAD + b->used;
+  b->used += size;
+  return p;
+}
+
+/* Free everything allocated in a, keeping the blocks.  */
+void
+reset_arena(arena_p_t a)
+{
+  arena_blk_p_t b;
+  for (b = a->first; b != NULL; b = b->next)
+    b->used = 0;
+  a->cur = a->first;
+}
+
+void
+free_arena(arena_p_t a)
+{
+  while (a->first != NULL) {
+    arena_blk_p_t b = a->first;
+    a->first = b->next;
+    free(b);
+  }
+  a->cur = NULL;
+}
+
+/* Free a result allocated on its own.  */
+static void
+freeResult(result_p_t r)
+{
+  free(r->edits);
+  free(r->s);
+  free(r->aa);
+  free(r);
+}
+
+/* Add to rc a result with room for nEdits edits, a coding sequence of
+   len bytes and a protein of aaLen bytes, or none if 0.  Returns NULL on
+   error.  */
+static result_p_t
+newResult(col_p_t rc, unsigned int nEdits, size_t len, size_t aaLen)
+{
+  size_t eSize = nEdits * sizeof(unsigned int);
+  result_p_t r;
+  if (rc->arena != NULL) {
+    r = (result_p_t) arena_alloc(rc->arena,
+				 sizeof(result_t) + eSize + len + aaLen);
+    if (r == NULL)
+      return NULL;
+    r->edits = nEdits > 0 ? (unsigned int *) (r + 1) : NULL;
+    r->s = len > 0 ? (unsigned char *) (r + 1) + eSize : NULL;
+    r->aa = aaLen > 0 ? (char *) (r + 1) + eSize + len : NULL;
+  } else {
+    if ((r = (result_p_t) allocate(sizeof(result_t))) == NULL)
+      return NULL;
+    r->edits = nEdits > 0 ? (unsigned int *) allocate(eSize) : NULL;
+    r->s = len > 0 ? (unsigned char *) allocate(len) : NULL;
+    r->aa = aaLen > 0 ? (char *) allocate(aaLen) : NULL;
+    if ((nEdits > 0 && r->edits == NULL) || (len > 0 && r->s == NULL)
+	|| (aaLen > 0 && r->aa == NULL)) {
+      freeResult(r);
+      return NULL;
+    }
+  }
+  r->nEdits = nEdits;
+  r->phase = 0;
+  if (add_col_elt(rc, r, 8) != 0) {
+    /* What is in the arena goes with the next reset.  */
+    if (rc->arena == NULL)
+      freeResult(r);
+    return NULL;
+  }
+  return r;
+}
+
+static int
+setByCode(matrix_p_t m)
+{
+  size_t sSize = 1, i;
+  unsigned int f;
+  for (f = 0; f < m->order; f++)
+    sSize *= 5;
+  m->byIndex = (signed char *) allocate(sSize * m->frames);
+  if (m->byIndex == NULL)
+    return -1;
+  for (i = 0; i < sSize; i++)
+    for (f = 0; f < m->frames; f++)
+      m->byIndex[i * m->frames + f] = m->m[f][i];
+  m->byCode = NULL;
+  if (m->order == 1) {
+    unsigned int code, frame;
+    m->byCode = (int *) allocate(sizeof(int) * 5 * m->frames);
+    if (m->byCode == NULL)
+      return -1;
+    for (code = 0; code < 5; code++)
+      for (frame = 0; frame < m->frames; frame++)
+	m->byCode[code * m->frames + frame] = m->m[frame][code];
+  }
+  return 0;
+}
+
+/* Build the score tables of m from the nElt scores of data.  Whatever
+   was allocated is left in m for freeMatrix if this fails.  */
+static int
+CreateMatrix(matrix_p_t m, signed char *data, unsigned int nElt,
+	     const params_t *p)
+{
+  int i, bad = 0;
+  unsigned int frame;
+  unsigned int sSize = 1;
+  unsigned int *step, *sStep;
+
+  m->map = NULL;
+  m->mapSize = 0;
+  if (m->order < 1)
+    return failed("CreateMatrix: order should be >=1 (%d)\n", m->order);
+  if ((m->m = (signed char **) allocate(sizeof(signed char *) * m->frames))
+      == NULL)
+    return -1;
+  memset(m->m, 0, sizeof(signed char *) * m->frames);
+  step = (unsigned int *) allocate(sizeof(unsigned int) * m->order);
+  sStep = (unsigned int *) allocate(sizeof(unsigned int) * m->order);
+  if (step == NULL || sStep == NULL) {
+    free(step);
+    free(sStep);
+    return -1;
+  }
+  /* Compute some stepping info.  */
+  step[m->order - 1] = 4;
+  sStep[m->order - 1] = 5;
+  for (i = m->order - 2; i >= 0; i--) {
+    step[i] = step[i + 1] * 4;
+    sStep[i] = sStep[i + 1] * 5;
+  }
+  /* Check the size of the array.  */
+  if (step[0] * m->frames != nElt) {
+    failed("CreateMatrix: bad array size (%d, should be %d)\n",
+	   nElt, step[0] * m->frames);
+    free(step);
+    free(sStep);
+    return -1;
+  }
+  /* Compute the score table size.  */
+  for (frame = 0; frame < m->order; frame++)
+    sSize *= 5;
+  for (frame = 0; frame < m->frames; frame++) {
+    signed char *ptr;
+    /* Get space for the score tables.  */
+    m->m[frame] = (signed char *) allocate(sizeof(signed char) * sSize);
+    if ((ptr = m->m[frame]) == NULL) {
+      free(step);
+      free(sStep);
+      return -1;
+    }
+    /* Process the array.  */
+    for (i = 0; i < (int) step[0]; i++) {
+      int val = *data++;
+      int j;
+      /* Do not go below min.  */
+      val = (val < p->min) ? p->min : val;
+      *ptr++ = val;
+      for (j = m->order - 1; j >= 0; j--) {
+	if ((i + 1) % step[j] == 0) {
+	  /* We have to fill in the next sStep[j]/5 score slots.  */
+	  int k;
+	  int stepping = sStep[j] / 5;
+	  if (p->Nvalue == 0) {
+	    /* Plain average thing.  */
+	    for (k = 0; k < stepping - 1; k++) {
+	      int avg = *(ptr - stepping) + *(ptr - stepping * 2)
+		      + *(ptr - stepping * 3) + *(ptr - stepping * 4);
+	      avg /= 4;
+	      *ptr++ = avg;
+	    }
+	    *ptr++ = 0; /* Null expectation to accept an N.  */
+	  } else {
+	    /* Something a bit more funky...  */
+	    for (k = 0; k < stepping - 1; k++) {
+	      int avg;
+	      int sorted[4];
+	      sorted[0] = *(ptr - stepping);
+	      sorted[1] = *(ptr - stepping * 2);
+	      sorted[2] = *(ptr - stepping * 3);
+	      sorted[3] = *(ptr - stepping * 4);
+	      /* Need to sort the darn thing...  */
+	      qsort(sorted, 4, sizeof(int), intCompare);
+	      switch(p->Nvalue) {
+	      case 1:
+		avg = sorted[3];
+		break;
+	      case 2:
+		avg = (sorted[3] + sorted[2]) / 2;
+		break;
+	      case 3:
+		avg = (sorted[3] + sorted[2] + sorted[1]) / 3;
+		break;
+	      case -1:
+		avg = sorted[0];
+		break;
+	      case -2:
+		avg = (sorted[0] + sorted[1]) / 2;
+		break;
+	      case -3:
+		avg = (sorted[0] + sorted[1] + sorted[2]) / 3;
+		break;
+	      default:
+		avg = 0;
+		bad = 1;
+	      }
+	      *ptr++ = avg;
+	    }
+	    *ptr++ = 0; /* Null expectation to accept an N.  */
+	  }
+	}
+      }
+    }
+  }
+  free(step);
+  free(sStep);
+  if (bad)
+    return failed("Bad method (%d) to compute N score value.\n", p->Nvalue);
+  return setByCode(m);
+}
+
+/* A, C, G and T are 0 to 3, everything else is 4.  */
+static inline unsigned int
+GetCode(unsigned char c)
+{
+  return dna_code[c];
+}
+
+/* Char at position pos of the given strand of seq.  The reverse strand
+   is read backwards through dna_complement, so that the sequence is
+   never rewritten.  */
+static inline unsigned char
+strandChar(const seq_t *seq, unsigned int pos, int reverse)
+{
+  if (reverse)
+    return dna_complement[seq->seq[seq->len - 1 - pos]];
+  return seq->seq[pos];
+}
+
+/* The n chars of the strand being scanned from pos on, in place on the
+   forward strand, else copied to sc->eChar.  */
+static inline const unsigned char *
+strandChunk(scanner_p_t sc, seq_p_t seq, unsigned int pos, unsigned int n)
+{
+  size_t at = pos;
+  if (!sc->reverse)
+    return seq->seq + pos;
+  seq_read_strand(seq, 1, &at, sc->eChar, n);
+  return sc->eChar;
+}
+
+static inline void
+findMax(int prev, const int *prevV, int transit, int *bPrev, int *bScore)
+{
+  int score = prevV[prev] + transit;
+  if (score > *bScore) {
+    *bScore = score;
+    *bPrev = prev;
+  }
+}
+
+static inline void
+findMax0(int prev, const int *prevV, int *bPrev, int *bScore)
+{
+  int score = prevV[prev];
+  if (score > *bScore) {
+    *bScore = score;
+    *bPrev = prev;
+  }
+}
+
+static void
+setBranch(layout_p_t l, unsigned int b, unsigned int *n, int state, int transit)
+{
+  l->cand[b][*n] = state;
+  l->ctrans[b][*n] = transit;
+  *n += 1;
+}
+
+/* returns frame if <state> is coding, relies on startoffset,
+   startlength, stopoffset and stoplength to be multiples of
+   3, returns -1 if not coding */
+static inline int
+getFrame(const layout_t *l, int state, int tsize, int startoffset,
+	 int stopoffset)
+{
+  int f;
+  int d = state - l->iStart - startoffset + 1;
+  if (d < 0)
+    return -1;
+  if (state < (l->iStop + stopoffset))
+    return(d % 3);
+  for (f = 1; f < tsize; f++) {
+    if ((l->iInsAfter[(12 - f) % 3] + f) == state)
+      return 0;
+    if ((l->iInsAfter[(13 - f) % 3] + f) == state)
+      return 1;
+    if ((l->iInsAfter[(14 - f) % 3] + f) == state)
+      return 2;
+    if ((l->iDelAfter[(14 - f) % 3] + f - 1) == state)
+      return 0;
+    if ((l->iDelAfter[(15 - f) % 3] + f - 1) == state)
+      return 1;
+    if ((l->iDelAfter[(16 - f) % 3] + f - 1) == state)
+      return 2;
+  }
+  return -1;
+}
+
+/* Compute the state indices for the given matrices, together with the
+   predecessor tables used to rebuild the path from the traceback words.
+   Nothing is done when the shape did not change since the last call.  */
+static int
+initIndices(layout_p_t l, const params_t *p, matrix_p_t *M)
+{
+  int tsize = M[MT_CODING]->order;
+  int startlen = M[MT_START]->frames;
+  int stoplen = M[MT_STOP]->frames;
+  unsigned int states = 2 + startlen + stoplen + 6 * tsize;
+  unsigned int f, s, b, n, bits;
+  if (l->pred != NULL && l->tsize == tsize && l->startlen == startlen
+      && l->startoff == M[MT_START]->offset && l->stoplen == stoplen
+      && l->stopoff == M[MT_STOP]->offset)
+    return 0;
+  /* Not a layout to keep until done.  */
+  l->tsize = 0;
+  n = 8 + (startlen + 2) / 3 + 2 * tsize;
+  if (resize(&l->pred, sizeof(int) * states) != 0
+      || resize(&l->cand[0], 2 * NB_BRANCH * n * sizeof(int)) != 0
+      || resize(&l->coding, states) != 0
+      || resize(&l->frame, states) != 0
+      || resize(&l->edge, sizeof(int) * states) != 0)
+    return -1;
+  l->tsize = tsize;
+  l->startlen = startlen;
+  l->startoff = M[MT_START]->offset;
+  l->stoplen = stoplen;
+  l->stopoff = M[MT_STOP]->offset;
+  l->iBegin = -1;
+  l->i5utr = 0;
+  l->iStart = 1;
+  l->iCds = l->iStart + startlen;
+  l->iStop = l->iCds + 3;
+  l->i3utr = l->iStop + stoplen;
+  for (f = 0; f < 3; f++) {
+    l->iInsAfter[f] = l->i3utr + f * tsize + 1;
+    l->iDelAfter[f] = l->i3utr + (f + 3) * tsize - f + 1;
+  }
+  for (f = 0; f < 3; f++) {
+    unsigned int f1;
+    for (f1 = 0; f1 < 3; f1++) {
+      if ((f1 + tsize)     % 3 == f)
+	l->iInsNext[f] = l->iInsAfter[f1] + tsize - 1;
+      if ((f1 + tsize + 1) % 3 == f)
+	l->iDelNext[f] = l->iDelAfter[f1] + tsize - 2;
+    }
+  }
+  l->states = states;
+  /* Most states have a single predecessor, the previous state in their
+     chain.  */
+  for (s = 0; s < l->states; s++)
+    l->pred[s] = s - 1;
+  l->pred[l->i5utr] = l->i5utr;
+  l->pred[l->iStart] = l->i5utr;
+  for (f = 0; f < 3; f++) {
+    l->pred[l->iInsAfter[f]] = l->iCds + f;
+    l->pred[l->iDelAfter[f]] = l->iCds + f;
+  }
+  /* The CDS, first stop profile and 3'UTR states choose among several
+     candidates, listed in the order they are tried in nextColumn.  */
+  for (b = 1; b < NB_BRANCH; b++)
+    l->cand[b] = l->cand[b - 1] + n;
+  l->ctrans[0] = l->cand[NB_BRANCH - 1] + n;
+  for (b = 1; b < NB_BRANCH; b++)
+    l->ctrans[b] = l->ctrans[b - 1] + n;
+  for (b = 0; b < NB_BRANCH; b++)
+    l->nCand[b] = 0;
+  setBranch(l, 0, &l->nCand[0], l->iCds - 1, 0);
+  setBranch(l, 0, &l->nCand[0], l->i5utr, p->min);
+  setBranch(l, 0, &l->nCand[0], l->iCds + 2, 0);
+  setBranch(l, 0, &l->nCand[0], l->iInsNext[0], 0);
+  setBranch(l, 0, &l->nCand[0], l->iDelNext[0], 0);
+  for (f = 1; f < 3; f++) {
+    setBranch(l, f, &l->nCand[f], l->iCds + f - 1, 0);
+    setBranch(l, f, &l->nCand[f], l->iInsNext[f], 0);
+    setBranch(l, f, &l->nCand[f], l->iDelNext[f], 0);
+  }
+  for (f = M[MT_START]->offset + 2; f < (unsigned int) startlen; f += 3)
+    setBranch(l, 3, &l->nCand[3], l->iStart + f, p->min);
+  for (f = 0; f < (unsigned int) tsize; f++)
+    setBranch(l, 3, &l->nCand[3], l->iInsAfter[(14 - f) % 3] + f, p->min);
+  for (f = 0; f < (unsigned int) tsize - 1; f++)
+    setBranch(l, 3, &l->nCand[3], l->iDelAfter[(15 - f) % 3] + f, p->min);
+  setBranch(l, 3, &l->nCand[3], l->iCds + 2, p->tc3uPen);
+  setBranch(l, 4, &l->nCand[4], l->i3utr - 1, 0);
+  setBranch(l, 4, &l->nCand[4], l->i3utr, 0);
+  setBranch(l, 4, &l->nCand[4], l->iCds + 2, p->min);
+  /* Pack the choices in one word per position.  */
+  bits = 0;
+  for (b = 0; b < NB_BRANCH; b++) {
+    unsigned int w = 1;
+    while ((1U << w) < l->nCand[b])
+      w += 1;
+    l->bShift[b] = bits;
+    l->bMask[b] = (1U << w) - 1;
+    bits += w;
+  }
+  if (bits > 32) {
+    l->tsize = 0;
+    return failed("Too many transitions to encode the traceback (%u bits)\n",
+		  bits);
+  }
+  for (f = 0; f < 3; f++)
+    l->pred[l->iCds + f] = -2 - f;
+  l->pred[l->iStop] = -2 - 3;
+  l->pred[l->i3utr] = -2 - 4;
+  for (s = 0; s < l->states; s++)
+    l->coding[s] = ((l->iStart + l->startoff - 1 <= (int) s
+		     && (int) s <= l->iStop + l->stopoff - 1)
+		    || l->iInsAfter[0] <= (int) s);
+  for (s = 0; s < l->states; s++)
+    l->frame[s] = getFrame(l, s, tsize, l->startoff, l->stopoff);
+  /* States where a coding segment may open or close.  */
+  l->nEdge = 0;
+  for (s = 0; s < l->states; s++)
+    if (l->pred[s] < -1 || l->coding[s] != l->coding[l->pred[s]])
+      l->edge[l->nEdge++] = s;
+  return 0;
+}
+
+/* Return the state preceding state at a position whose traceback word
+   is w.  */
+static inline int
+prevState(const layout_t *l, unsigned int w, int state)
+{
+  int p = l->pred[state];
+  unsigned int b;
+  if (p >= -1)
+    return p;
+  b = -2 - p;
+  return l->cand[b][(w >> l->bShift[b]) & l->bMask[b]];
+}
+
+/* Choose the best candidate for branch b, and record the choice in the
+   traceback word.  */
+static inline int
+branchMax(const layout_t *l, unsigned int b, const int *prevV,
+	  unsigned int *w)
+{
+  const int *c = l->cand[b];
+  const int *t = l->ctrans[b];
+  int bScore = prevV[c[0]] + t[0];
+  unsigned int k, bCode = 0;
+  for (k = 1; k < l->nCand[b]; k++) {
+    int score = prevV[c[k]] + t[k];
+    if (score > bScore) {
+      bScore = score;
+      bCode = k;
+    }
+  }
+  *w |= bCode << l->bShift[b];
+  return bScore;
+}
+
+#ifdef DEBUG
+static void
+printIndex(unsigned int index, unsigned int len)
+{
+  char *s = (char *) malloc(sizeof(char) * (len + 1));
+  int i;
+  if (s == NULL)
+    return;
+  s[len] = 0;
+  for (i = len - 1; i >= 0; i--) {
+    int c = index % 5;
+    index /= 5;
+    switch (c) {
+    case 0:
+      s[i] = 'A';
+      break;
+    case 1:
+      s[i] = 'C';
+      break;
+    case 2:
+      s[i] = 'G';
+      break;
+    case 3:
+      s[i] = 'T';
+      break;
+    default:
+      s[i] = 'N';
+    }
+  }
+  fputs(s, stderr);
+  free(s);
+}
+
+static void
+printInitStatus(const layout_t *l, unsigned int states, unsigned int seqLen,
+		unsigned int tsize, unsigned int tableSize,
+		unsigned int tindex,
+		unsigned int *insTindex, unsigned int *delTindex)
+{
+  unsigned int f, i;
+  fprintf(stderr, "Begin: %d\n", l->iBegin);
+  fprintf(stderr, "5'UTR: %d\n", l->i5utr);
+  fprintf(stderr, "Start: %d\n", l->iStart);
+  fprintf(stderr, "Stop:  %d\n", l->iStop);
+  fprintf(stderr, "3'UTR: %d\n", l->i3utr);
+  for (f = 0; f < 3; f++)
+    fprintf(stderr, "Frame %u: CDS %d, insert after/next %d/%d, delete after/next %d/%d\n",
+	    f, l->iCds + f, l->iInsAfter[f], l->iInsNext[f], l->iDelAfter[f], l->iDelNext[f]);
+  fprintf(stderr, "states %u, seq length %u, tsize %u, tableSize %u, tindex ",
+	  states, seqLen, tsize, tableSize);
+  printIndex(tindex, tsize);
+  fprintf(stderr, "\ninsertion indices: ");
+  for (i = 0; i < tsize; i++) {
+    printIndex(insTindex[i], tsize);
+    fprintf(stderr, " ");
+  }
+  fprintf(stderr, "\ndeletion indices: ");
+  for (i = 0; i < tsize - 1; i++) {
+    printIndex(delTindex[i], tsize);
+    fprintf(stderr, " ");
+  }
+  fprintf(stderr, "\n");
+}
+
+static void
+printCurrentStatus(unsigned int p, unsigned char c, unsigned int code,
+		   unsigned int tindex, unsigned int tsize,
+		   unsigned int *insTindex, unsigned int *delTindex,
+		   unsigned int states,
+		   int *currV, unsigned int trWord)
+{
+  unsigned int i;
+  fprintf(stderr, "%u:%c-%u: ", p, c, code);
+  printIndex(tindex, tsize);
+  fprintf (stderr, " /");
+  for (i = 0; i < tsize; i++) {
+    fprintf(stderr, " ");
+    printIndex(insTindex[i], tsize);
+  }
+  fprintf(stderr, " /");
+  for (i = 0; i < tsize - 1; i++) {
+    fprintf(stderr, " ");
+    printIndex(delTindex[i], tsize);
+  }
+  fprintf(stderr, "\ntraceback word %08x\n", trWord);
+  for (i = 0; i < states; i++) {
+    if (currV[i] < INT_MIN / 3)
+      fprintf(stderr, "  -inf");
+    else
+      fprintf(stderr, "%6d", currV[i]);
+    if ((i % 10) == 9)
+      fprintf(stderr, "\n");
+  }
+  fprintf(stderr, "\n");
+}
+#endif
+
+void
+default_params(params_p_t p)
+{
+  p->min = -100;
+  p->dPen = -50;
+  p->iPen = -50;
+  p->ts5uPen = -10;
+  p->tscPen = -10;
+  p->ts3uPen = -5;
+  p->t5ucPen = -80;
+  p->t5uePen = -40;
+  p->tc3uPen = -80;
+  p->tcePen = -40;
+  p->t3uePen = -20;
+  p->percent = 4.0;
+  p->Nvalue = 0;
+  p->minLen = 50;
+  p->results = RES_SEQ;
+}
+
+/* Scanner with the matrices of mc and the parameters p, which are
+   copied.  */
+scanner_p_t
+es_scanner_new(col_p_t mc, const params_t *p)
+{
+  scanner_p_t sc = (scanner_p_t) allocate(sizeof(scanner_t));
+  if (sc != NULL) {
+    memset(sc, 0, sizeof(scanner_t));
+    sc->mc = mc;
+    sc->p = *p;
+  }
+  return sc;
+}
+
+void
+es_scanner_free(scanner_p_t sc)
+{
+  if (sc == NULL)
+    return;
+  free(sc->V);
+  free(sc->tr);
+  free(sc->insTindex);
+  free(sc->delTindex);
+  free(sc->ckV);
+  free(sc->ckTindex);
+  free(sc->l.pred);
+  free(sc->l.cand[0]);
+  free(sc->l.coding);
+  free(sc->l.frame);
+  free(sc->l.edge);
+  free(sc->bTindex);
+  free(sc->off);
+  free(sc->bE);
+  free(sc->seg);
+  free(sc->trace);
+  free(sc->edits);
+  free(sc->sChar);
+  free(sc->sTr);
+  free(sc->sSet);
+  free(sc->hChar);
+  free(sc->hEdit);
+  free(sc);
+}
+
+/* Reset the rolling indices into the score tables to all N's.  */
+static void
+initTindex(scanner_p_t sc)
+{
+  unsigned int order = sc->M[MT_CODING]->order;
+  unsigned int i;
+  /* tindex will point to the position representing the last
+   * M[MT_CODING]->order chars on seq */
+  /* tindex now represents all N's */
+  sc->tindex = sc->tableSize - 1;
+  for (i = 0; i < order - 1; i++)
+    sc->insTindex[i] = sc->delTindex[i] = sc->tindex;
+  sc->insTindex[i] = sc->tindex;
+}
+
+/* (5 * index + code) % tableSize, for index < tableSize, without a
+   division.  */
+static inline unsigned int
+rollIndex(unsigned int index, unsigned int code, unsigned int tableSize)
+{
+  unsigned int r = 5 * index + code;
+  return r - tableSize * ((r >= tableSize) + (r >= 2 * tableSize)
+			  + (r >= 3 * tableSize) + (r >= 4 * tableSize));
+}
+
+/* Move the rolling indices one char forward, or only tindex at the
+   first char.  */
+static inline void
+rollTindex(unsigned int order, unsigned int tableSize, unsigned int *tindex,
+	   unsigned int *insTindex, unsigned int *delTindex,
+	   unsigned int code, int first)
+{
+  unsigned int i;
+  if (!first) {
+    for (i = order - 1; i > 0; i--)
+      insTindex[i] = rollIndex(insTindex[i - 1], code, tableSize);
+    if (order > 2)
+      for (i = order - 2; i > 0; i--)
+	delTindex[i] = rollIndex(delTindex[i - 1], code, tableSize);
+    insTindex[0] = *tindex;
+    delTindex[0] = rollIndex(rollIndex(*tindex, 4, tableSize), code,
+			     tableSize);
+  }
+  *tindex = rollIndex(*tindex, code, tableSize);
+}
+
+/* The kernels below take the shape of the model, the order of the coding
+   matrix and the frames of the start and stop profiles, as arguments.
+   They are instantiated for a few common shapes with constant arguments,
+   see SCAN_KERNELS, which turns the state indices of the layout into
+   constants and fully unrolls the chains.  The indices are those set by
+   initIndices.  */
+#define SHAPE_INDICES(order, startlen, stoplen)				\
+  const unsigned int iCds = 1 + (startlen);				\
+  const unsigned int iStop = iCds + 3;					\
+  const unsigned int i3utr = iStop + (stoplen);				\
+  const unsigned int iIns0 = i3utr + 1;					\
+  const unsigned int iDel0 = iIns0 + 3 * (order);			\
+  const unsigned int states = i3utr + 6 * (order) - 2;			\
+  (void) iStop, (void) iIns0, (void) iDel0, (void) states
+
+/* Kernels for one shape of the model.  */
+typedef struct _kernels_t {
+  unsigned int order;
+  unsigned int startlen;
+  unsigned int stoplen;
+  void (*emit)(scanner_p_t sc, const unsigned char *s, unsigned int pos,
+	       unsigned int n);
+  void (*column)(scanner_p_t sc, unsigned int code, const int *E,
+		 const int *prevV, int *currV, unsigned int *currTr);
+#ifdef __GNUC__
+  void (*batch)(scanner_p_t sc, seq_p_t *seqs, const int *rev,
+		unsigned int len);
+#ifdef HAVE_NARROW
+  void (*narrow)(scanner_p_t sc, seq_p_t *seqs, const int *rev,
+		 unsigned int len, int *bad);
+#endif
+#endif
+} kernels_t;
+
+static const kernels_t *shapeKernels(const matrix_p_t *M);
+
+/* Store the emission score of each state s, given the rolling indices
+   of its char, in E[s * stride].  The start and stop profiles, which
+   only depend on the char, are left out, and so is the first state of
+   each insertion chain.  The coding matrix has 3 frames.  */
+static inline ALWAYS_INLINE void
+emitRow(const scanner_t *sc, unsigned int tindex,
+	const unsigned int *insTindex, const unsigned int *delTindex,
+	int *E, unsigned int stride, unsigned int order,
+	unsigned int startlen, unsigned int stoplen)
+{
+  SHAPE_INDICES(order, startlen, stoplen);
+  const signed char *cod = sc->M[MT_CODING]->byIndex;
+  const signed char *utr = sc->M[MT_UNTRANSLATED]->m[0];
+  unsigned int i;
+  E[0] = utr[tindex];
+  E[iCds * stride] = cod[3 * tindex];
+  E[(iCds + 1) * stride] = cod[3 * tindex + 1];
+  E[(iCds + 2) * stride] = cod[3 * tindex + 2];
+  E[i3utr * stride] = utr[tindex];
+  /* Chain f reads frame (i + f) % 3 at its state i.  */
+  for (i = 1; i < order; i++) {
+    const signed char *c = cod + 3 * insTindex[i];
+    unsigned int f = i % 3;
+    E[(iIns0 + i) * stride] = c[f];
+    E[(iIns0 + order + i) * stride] = c[f == 2 ? 0 : f + 1];
+    E[(iIns0 + 2 * order + i) * stride] = c[f == 0 ? 2 : f - 1];
+  }
+  for (i = 0; i < order - 1; i++) {
+    const signed char *c = cod + 3 * delTindex[i];
+    unsigned int f = (i + 2) % 3;
+    E[(iDel0 + i) * stride] = c[f];
+    E[(iDel0 + order - 1 + i) * stride] = c[f == 2 ? 0 : f + 1];
+    E[(iDel0 + 2 * order - 2 + i) * stride] = c[f == 0 ? 2 : f - 1];
+  }
+}
+
+/* Fill in sc->bE with the emission scores of the n positions from pos
+   on, whose chars on the strand are s, one row of states per position,
+   and sc->eCode with their codes.  Move the rolling indices past
+   them.  */
+static inline ALWAYS_INLINE void
+emitScoresShape(scanner_p_t sc, const unsigned char *s, unsigned int pos,
+		unsigned int n, unsigned int order, unsigned int startlen,
+		unsigned int stoplen)
+{
+  SHAPE_INDICES(order, startlen, stoplen);
+  int *E = sc->bE;
+  unsigned int k;
+  for (k = 0; k < n; k++, E += states) {
+    unsigned int code = GetCode(s[k]);
+    sc->eCode[k] = code;
+    rollTindex(order, sc->tableSize, &sc->tindex, sc->insTindex,
+	       sc->delTindex, code, pos + k == 0);
+    emitRow(sc, sc->tindex, sc->insTindex, sc->delTindex, E, 1,
+	    order, startlen, stoplen);
+  }
+}
+
+/* Fill in the Viterbi column and traceback word for the first char on
+   seq, given its code and emission scores E.  */
+static void
+firstColumn(scanner_p_t sc, unsigned int code, const int *E, int *currV,
+	    unsigned int *currTr)
+{
+  matrix_p_t *M = sc->M;
+  layout_p_t l = &sc->l;
+  unsigned int f, s;
+  currV[l->i5utr] = sc->p.ts5uPen + E[l->i5utr];
+  for (f = 0; f < M[MT_START]->frames; f++)
+    currV[l->iStart + f] = sc->p.min + M[MT_START]->m[f][code];
+  for (f = 0; f < 3; f++)
+    currV[l->iCds + f] = sc->p.tscPen + E[l->iCds + f];
+  for (f = 0; f < M[MT_STOP]->frames; f++)
+    currV[l->iStop + f] = sc->p.min + M[MT_STOP]->m[f][code];
+  currV[l->i3utr] = sc->p.ts3uPen + E[l->i3utr];
+  for (s = l->i3utr + 1; s < l->states; s++)
+    currV[s] = INT_MIN / 2;
+  /* All states go back to iBegin, see traceback.  */
+  *currTr = 0;
+}
+
+/* Move a chain of states one position forward:
+   currV[s] = prevV[s - 1] + scores[s - first] for first <= s < end.  */
+static inline void
+chainShift(int *currV, const int *prevV, const int *scores,
+	   unsigned int first, unsigned int end)
+{
+  unsigned int s = first;
+#ifdef __GNUC__
+  for ( ; s + VCOL_INTS <= end; s += VCOL_INTS)
+    *(vcol_t *) (currV + s) = *(const vcol_t *) (prevV + s - 1)
+			      + *(const vcol_t *) (scores + s - first);
+#endif
+  for ( ; s < end; s++)
+    currV[s] = prevV[s - 1] + scores[s - first];
+}
+
+/* Fill in the Viterbi column and traceback word of a char, given its
+   code, its emission scores E and the column of the previous char.  */
+static inline ALWAYS_INLINE void
+nextColumnShape(scanner_p_t sc, unsigned int code, const int *E,
+		const int *prevV, int *currV, unsigned int *currTr,
+		unsigned int order, unsigned int startlen, unsigned int stoplen)
+{
+  SHAPE_INDICES(order, startlen, stoplen);
+  matrix_p_t *M = sc->M;
+  layout_p_t l = &sc->l;
+  const int *start = M[MT_START]->byCode + code * startlen;
+  const int *stop = M[MT_STOP]->byCode + code * stoplen;
+  unsigned int f;
+  unsigned int w = 0;
+  /* consider current nucleotide in 5'UTR */
+  /* transitions UTR->UTR and CDS->CDS are presumed zero */
+  currV[0] = prevV[0] + E[0];
+  /* consider current nucleotide in start profile */
+  currV[1] = prevV[0] + sc->p.t5ucPen + start[0];
+  chainShift(currV, prevV, start + 1, 2, iCds);
+  /* consider current nucleotide in CDS */
+  for (f = 0; f < 3; f++)
+    currV[iCds + f] = branchMax(l, f, prevV, &w) + E[iCds + f];
+  /* consider current nucleotide in stop profile */
+  currV[iStop] = branchMax(l, 3, prevV, &w) + stop[0];
+  chainShift(currV, prevV, stop + 1, iStop + 1, i3utr);
+  /* consider current nucleotide in 3' UTR */
+  currV[i3utr] = branchMax(l, 4, prevV, &w) + E[i3utr];
+  /* consider current nucleotide in CDS after insertion or deletion, the
+     chains follow each other, and their first states come from CDS */
+  chainShift(currV, prevV, E + iIns0, iIns0, states);
+  for (f = 0; f < 3; f++) {
+    currV[iIns0 + f * order] = prevV[iCds + f] + sc->p.iPen;
+    currV[iDel0 + f * (order - 1)] = prevV[iCds + f] + sc->p.dPen
+				     + E[iDel0 + f * (order - 1)];
+  }
+  *currTr = w;
+}
+
+/* Parallel scan of a strand by n scanners, see ComputeParallel.  The
+   blocks of segment k are first[k] to first[k + 1] - 1, and last holds
+   the Viterbi column ending each segment.  During the traceback, wave
+   has the blocks to fill in, one per scanner, and held those the
+   scanners other than the first one hold, or UINT_MAX.  */
+typedef struct _par_t {
+  scanner_p_t *sc;
+  unsigned int n;
+  seq_p_t seq;
+  unsigned int *first;
+  int *last;
+  /* Checkpoints and last columns of the runs of parSegment from the
+     coding states, and for each block, the 3'UTR scores of the paths
+     entering it in the block for both runs, and of those staying in
+     it.  */
+  int *ckC;
+  int *cLast;
+  int *uFresh;
+  int *cFresh;
+  int *stay;
+  unsigned int *wave;
+  unsigned int *held;
+  pthread_t *tid;
+  int *started;
+  struct _par_arg_t *arg;
+} par_t, *par_p_t;
+
+static void parBlock(scanner_p_t sc, unsigned int b);
+
+/* Rolling indices are saved at each checkpoint as tindex, then the
+   order insertion indices, then the order - 1 deletion indices.  */
+static void
+saveTindex(scanner_p_t sc, unsigned int *ck)
+{
+  unsigned int order = sc->M[MT_CODING]->order;
+  ck[0] = sc->tindex;
+  memcpy(ck + 1, sc->insTindex, order * sizeof(unsigned int));
+  memcpy(ck + 1 + order, sc->delTindex, (order - 1) * sizeof(unsigned int));
+}
+
+static void
+restoreTindex(scanner_p_t sc, const unsigned int *ck)
+{
+  unsigned int order = sc->M[MT_CODING]->order;
+  sc->tindex = ck[0];
+  memcpy(sc->insTindex, ck + 1, order * sizeof(unsigned int));
+  memcpy(sc->delTindex, ck + 1 + order, (order - 1) * sizeof(unsigned int));
+}
+
+/* Fill in block b of the Viterbi and traceback tables.  Blocks other
+   than the first one start from the checkpointed column preceding
+   them.  A streaming scan reads its chars from, and writes its
+   traceback words to, those it keeps.  The scanners of a parallel scan
+   share the checkpoints of the first one.  */
+static void
+fillBlock(scanner_p_t sc, seq_p_t seq, unsigned int b)
+{
+  const scanner_t *cs = sc->par != NULL ? ((par_p_t) sc->par)->sc[0] : sc;
+  unsigned int states = sc->l.states;
+  unsigned int pos = b * sc->bLen;
+  unsigned int end = min(pos + sc->bLen, seq->len);
+  unsigned int ck = sc->stream ? b - sc->sOff / sc->bLen : b;
+  int *currV = sc->V;
+  unsigned int *currTr = sc->stream ? sc->sTr + (pos - sc->sOff) : sc->tr;
+  const int *prevV = NULL;
+  if (b == 0)
+    initTindex(sc);
+  else {
+    restoreTindex(sc, cs->ckTindex + ck * sc->ckTsize);
+    prevV = cs->ckV + (size_t) ck * states;
+  }
+  while (pos < end) {
+    unsigned int n = min(end - pos, EMIT_CHUNK);
+    const int *E = sc->bE;
+    const unsigned char *code = sc->eCode;
+    const unsigned char *s = sc->stream ? sc->sChar + (pos - sc->sOff)
+			     : strandChunk(sc, seq, pos, n);
+    sc->kern->emit(sc, s, pos, n);
+    for ( ; n > 0; n--, pos++, E += states, code++, s++) {
+      if (pos == 0)
+	firstColumn(sc, *code, E, currV, currTr);
+      else
+	sc->kern->column(sc, *code, E, prevV, currV, currTr);
+#ifdef DEBUG
+      printCurrentStatus(pos, *s, *code, sc->tindex, sc->M[MT_CODING]->order,
+			 sc->insTindex, sc->delTindex, states, currV, *currTr);
+#endif
+      prevV = currV;
+      currV += states;
+      currTr += 1;
+    }
+  }
+  sc->bStart = b * sc->bLen;
+}
+
+/* Row in the current block of the column for position pos, which is
+   recomputed from its checkpoint when needed.  Positions only decrease
+   during traceback, so each block is recomputed at most once, but for
+   the successive tracebacks of a streaming scan.  */
+static inline size_t
+blockRow(scanner_p_t sc, seq_p_t seq, int pos)
+{
+  if (pos < (int) sc->bStart
+      || (sc->stream && pos >= (int) (sc->bStart + sc->bLen))) {
+    if (sc->par != NULL)
+      parBlock(sc, pos / sc->bLen);
+    else
+      fillBlock(sc, seq, pos / sc->bLen);
+  }
+  return (size_t) (pos - sc->bStart);
+}
+
+/* Return the state at position pos - 1 on the path going through state
+   at position pos.  */
+static inline int
+traceBack(scanner_p_t sc, seq_p_t seq, int pos, int state)
+{
+  size_t row;
+  if (pos == 0)
+    return sc->l.iBegin;
+  if (sc->stream)
+    return prevState(&sc->l, sc->sTr[pos - sc->sOff], state);
+  /* blockRow may change sc->tr in a parallel scan.  */
+  row = blockRow(sc, seq, pos);
+  return prevState(&sc->l, sc->tr[row * sc->lanes + sc->lane], state);
+}
+
+/* Viterbi score of state at row of the table, in the current lane.  */
+static inline int
+cellScore(scanner_p_t sc, size_t row, int state)
+{
+  size_t i = (row * sc->l.states + state) * sc->lanes + sc->lane;
+  if (sc->narrow)
+    return sc->off[row * sc->lanes + sc->lane] + ((const short *) sc->V)[i];
+  return sc->V[i];
+}
+
+/* Viterbi score of state at position pos.  */
+static inline int
+scoreAt(scanner_p_t sc, seq_p_t seq, int pos, int state)
+{
+  return cellScore(sc, blockRow(sc, seq, pos), state);
+}
+
+/* Column of the current lane at row of the Viterbi table.  */
+static const int *
+laneColumn(scanner_p_t sc, size_t row)
+{
+  unsigned int states = sc->l.states;
+  unsigned int s;
+  if (sc->lanes == 1)
+    return sc->V + row * states;
+  /* The checkpoints are not used by batches, borrow their space.  */
+  if (sc->ckVMax < states) {
+    if (resize(&sc->ckV, sizeof(int) * states) != 0)
+      return NULL;
+    sc->ckVMax = states;
+  }
+  for (s = 0; s < states; s++)
+    sc->ckV[s] = cellScore(sc, row, s);
+  return sc->ckV;
+}
+
+/* Set up the tables for blocks of bLen columns, and nb checkpoints.  */
+static int
+blockTables(scanner_p_t sc, unsigned int nb)
+{
+  unsigned int states = sc->l.states;
+  size_t mSize = sizeof(int) * (size_t) sc->bLen * states;
+  sc->lanes = 1;
+  sc->lane = 0;
+  sc->narrow = 0;
+  if (sc->maxSize < mSize) {
+    if (resize(&sc->V, mSize) != 0)
+      return -1;
+    sc->maxSize = mSize;
+  }
+  if (sc->trMax < sc->bLen) {
+    if (resize(&sc->tr, sizeof(unsigned int) * sc->bLen) != 0)
+      return -1;
+    sc->trMax = sc->bLen;
+  }
+  sc->ckTsize = 2 * sc->M[MT_CODING]->order;
+  if (sc->ckVMax < (size_t) nb * states) {
+    if (resize(&sc->ckV, sizeof(int) * nb * states) != 0)
+      return -1;
+    sc->ckVMax = (size_t) nb * states;
+  }
+  if (sc->ckTMax < (size_t) nb * sc->ckTsize) {
+    if (resize(&sc->ckTindex, sizeof(unsigned int) * nb * sc->ckTsize) != 0)
+      return -1;
+    sc->ckTMax = (size_t) nb * sc->ckTsize;
+  }
+  return 0;
+}
+
+/* Run the Viterbi over the whole sequence, keeping only the last block
+   of columns and a checkpoint column at the start of every block.  */
+static int
+forward(scanner_p_t sc, seq_p_t seq)
+{
+  unsigned int states = sc->l.states;
+  unsigned int b, nb;
+  size_t mSize = (sizeof(int) * states + sizeof(unsigned int))
+		 * (size_t) seq->len;
+  if (mSize <= FULL_TABLE_MAX)
+    sc->bLen = seq->len;
+  else {
+    sc->bLen = 1;
+    while ((size_t) sc->bLen * sc->bLen < seq->len)
+      sc->bLen += 1;
+  }
+  nb = (seq->len + sc->bLen - 1) / sc->bLen;
+  if (blockTables(sc, nb) != 0)
+    return -1;
+  for (b = 0; b < nb; b++) {
+    if (b > 0) {
+      memcpy(sc->ckV + (size_t) b * states,
+	     sc->V + (size_t) (sc->bLen - 1) * states, sizeof(int) * states);
+      saveTindex(sc, sc->ckTindex + b * sc->ckTsize);
+    }
+    fillBlock(sc, seq, b);
+  }
+  return 0;
+}
+
+/* Choose the matrices of mc for the GC content of seq.  Returns -1 if
+   some kind is missing.  */
+int
+SelectMatrices(col_p_t mc, seq_p_t seq, matrix_p_t *M)
+{
+  unsigned int i;
+  memset(M, 0, MT_COUNT * sizeof(matrix_p_t));
+  for (i = 0; i < mc->nb; i ++) {
+    if (seq->GC_pct >= mc->e.m[i]->CGmin
+	&& seq->GC_pct <= mc->e.m[i]->CGmax
+	&& M[mc->e.m[i]->matType] == NULL)
+      M[mc->e.m[i]->matType] = mc->e.m[i];
+  }
+  for (i = 0; i < MT_COUNT; i++)
+    if (M[i] == NULL)
+      return failed("We have no %d matrix for %.2f GC in:\n %s",
+		    i, seq->GC_pct, seq->header);
+  return 0;
+}
+
+/* Choose the matrices for the GC content of seq, and set up the state
+   layout and rolling indices for them.  */
+static int
+prepareScan(scanner_p_t sc, seq_p_t seq)
+{
+  matrix_p_t *M = sc->M;
+  unsigned int i;
+  if (SelectMatrices(sc->mc, seq, M) != 0)
+    return -1;
+  /* initialize some more parameters */
+  if (sc->maxOrder < M[MT_CODING]->order) {
+    unsigned int order = M[MT_CODING]->order;
+    if (resize(&sc->insTindex, sizeof(unsigned int) * order) != 0
+	|| resize(&sc->delTindex, sizeof(unsigned int) * order) != 0)
+      return -1;
+    sc->maxOrder = order;
+  }
+  if (M[MT_CODING]->frames != 3)
+    return failed("Coding matrix %s has %u frames instead of 3\n",
+		  M[MT_CODING]->name, M[MT_CODING]->frames);
+  /* size of score tables per frame */
+  sc->tableSize = 1;
+  for (i = 0; i < M[MT_CODING]->order; i++)
+    sc->tableSize *= 5;
+  /* compute the state indices */
+  if (initIndices(&sc->l, &sc->p, M) != 0)
+    return -1;
+  sc->kern = shapeKernels(M);
+  if (sc->bEMax < sc->l.states * EMIT_CHUNK) {
+    if (resize(&sc->bE, sizeof(int) * sc->l.states * EMIT_CHUNK) != 0)
+      return -1;
+    sc->bEMax = sc->l.states * EMIT_CHUNK;
+  }
+#ifdef DEBUG
+  initTindex(sc);
+  printInitStatus(&sc->l, sc->l.states, seq->len, M[MT_CODING]->order,
+		  sc->tableSize, sc->tindex, sc->insTindex, sc->delTindex);
+#endif
+  return 0;
+}
+
+/* Terminate the Viterbi on the last column and return the best final
+   state, its score in *bScore.  */
+static int
+bestEnd(scanner_p_t sc, const int *currV, int *bScore)
+{
+  matrix_p_t *M = sc->M;
+  layout_p_t l = &sc->l;
+  unsigned int i, f;
+  int bPrev = l->i5utr;
+  *bScore = currV[bPrev] + sc->p.t5uePen;
+  for (f = 0; f < M[MT_START]->frames; f++)
+    findMax(l->iStart+f, currV, sc->p.min, &bPrev, bScore);
+  for (f = 0; f < 3; f++) {
+    findMax(l->iCds+f, currV, sc->p.tcePen, &bPrev, bScore);
+    for (i = 0; i < M[MT_CODING]->order; i++)
+      findMax(l->iInsAfter[f] + i, currV, sc->p.tcePen, &bPrev, bScore);
+    for (i = 0; i < M[MT_CODING]->order - 1; i++)
+      findMax(l->iDelAfter[f] + i, currV, sc->p.tcePen, &bPrev, bScore);
+  }
+  for (f = 0; f < M[MT_STOP]->frames; f++)
+    findMax(l->iStop+f, currV, sc->p.min, &bPrev, bScore);
+  findMax(l->i3utr, currV, sc->p.t3uePen, &bPrev, bScore);
+#ifdef DEBUG
+  fprintf(stderr, "finished to fill Viterbi matrix, best score %d in state %d\n",
+	  *bScore, bPrev);
+#endif
+  return bPrev;
+}
+
+/* Close the coding segment of path info g, which ends at position stop
+   with score vScore.  */
+static inline void
+closeSeg(scanner_p_t sc, seg_p_t g, int vScore, int stop)
+{
+  int score = vScore - g->base;
+  if (score > g->best)
+    g->best = score;
+  /* Later segments come first in the results of Compute.  */
+  if (stop - g->start >= sc->p.minLen
+      && (g->lStart < 0 || score >= g->lScore)) {
+    g->lScore = score;
+    g->lStart = g->start;
+    g->lStop = stop;
+  }
+}
+
+/* Same as Compute, but only finds the best scoring coding segment, as
+   needed for max only output.  Instead of a traceback, each state
+   carries along the coding segments of its best path, so that only two
+   Viterbi columns are kept, and the strand is read as it goes.  At most
+   one result is added to rc, the best one longer than minLen, with no
+   sequence.  */
+int
+ComputeMax(scanner_p_t sc, seq_p_t seq, col_p_t rc, int reverse,
+	   int *maxScore)
+{
+  layout_p_t l = &sc->l;
+  unsigned int states, s, e;
+  int *prevV, *currV;
+  seg_p_t prevG, currG, g;
+  unsigned int pos, w;
+  int bPrev, bScore;
+  size_t at = 0;
+
+  if (seq->len == 0)
+    return 0;
+  if (prepareScan(sc, seq) != 0)
+    return -1;
+  states = l->states;
+  if (sc->maxSize < 2 * states * sizeof(int)) {
+    if (resize(&sc->V, 2 * states * sizeof(int)) != 0)
+      return -1;
+    sc->maxSize = 2 * states * sizeof(int);
+  }
+  if (sc->segMax < 2 * states) {
+    if (resize(&sc->seg, 2 * states * sizeof(seg_t)) != 0)
+      return -1;
+    sc->segMax = 2 * states;
+  }
+  currV = sc->V;
+  currG = sc->seg;
+  sc->reverse = reverse;
+  initTindex(sc);
+  seq_read_strand(seq, reverse, &at, sc->eChar, 1);
+  sc->kern->emit(sc, sc->eChar, 0, 1);
+  firstColumn(sc, sc->eCode[0], sc->bE, currV, &w);
+  for (s = 0; s < states; s++) {
+    g = currG + s;
+    g->start = 0;
+    g->base = 0;
+    g->best = INT_MIN;
+    g->lStart = -1;
+  }
+  for (pos = 1; pos < seq->len; pos++) {
+    unsigned int k = (pos - 1) % EMIT_CHUNK;
+    if (k == 0) {
+      unsigned int n = min(seq->len - pos, EMIT_CHUNK);
+      seq_read_strand(seq, reverse, &at, sc->eChar, n);
+      sc->kern->emit(sc, sc->eChar, pos, n);
+    }
+    prevV = currV;
+    prevG = currG;
+    currV = sc->V + (pos & 1) * states;
+    currG = sc->seg + (pos & 1) * states;
+    sc->kern->column(sc, sc->eCode[k], sc->bE + k * states, prevV, currV,
+		     &w);
+    for (s = 0; s < states; s++)
+      currG[s] = prevG[prevState(l, w, s)];
+    for (e = 0; e < l->nEdge; e++) {
+      int pp;
+      s = l->edge[e];
+      pp = prevState(l, w, s);
+      g = currG + s;
+      if (l->coding[s]) {
+	if (!l->coding[pp]) {
+	  g->start = pos;
+	  g->base = prevV[pp];
+	} else if ((int) s == l->iStop && pp == l->iCds + 2)
+	  /* remove stop-profile penalty from coding score */
+	  g->base += sc->p.tc3uPen;
+      } else if (l->coding[pp])
+	closeSeg(sc, g, prevV[pp], pos - 1);
+    }
+  }
+  bPrev = bestEnd(sc, currV, &bScore);
+  g = currG + bPrev;
+  if (l->coding[bPrev])
+    closeSeg(sc, g, currV[bPrev], seq->len - 1);
+  if (g->best > *maxScore)
+    *maxScore = g->best;
+  if (g->lStart >= 0) {
+    result_p_t r = newResult(rc, 0, 0, 0);
+    if (r == NULL)
+      return -1;
+    r->score = g->lScore;
+    r->start = g->lStart;
+    r->stop = g->lStop;
+    r->reverse = reverse;
+  }
+  return 0;
+}
+
+/* Fill in the coding sequence and protein of r, as asked for by
+   results, from the len chars traced back into res, last first.  The
+   protein leaves out the inserted nucleotides, and its stop codons are
+   X, but for the trailing ones which are removed.  */
+static void
+setResultSeq(result_p_t r, const unsigned char *res, size_t len, int results)
+{
+  const unsigned char *p = res + len;
+  unsigned char *s = r->s;
+  char *aa = r->aa;
+  char *keep = aa;
+  unsigned int codon = 0, n = 0;
+  while (p > res) {
+    unsigned char c = *--p;
+    if (!isupper(c)) {
+      if (s != NULL && (results & RES_NO_DEL) == 0)
+	*s++ = c;
+      continue;
+    }
+    if (s != NULL)
+      *s++ = c;
+    if (aa != NULL) {
+      codon = codon * 5 + dna_code[c];
+      if (++n == 3) {
+	char a = codon_aa[codon];
+	if (a == 'O')
+	  *aa++ = 'X';
+	else {
+	  *aa++ = a;
+	  keep = aa;
+	}
+	codon = 0;
+	n = 0;
+      }
+    }
+  }
+  if (s != NULL)
+    *s = 0;
+  if (aa != NULL) {
+    if (n > 0) {
+      while (n++ < 3)
+	codon = codon * 5 + dna_code['N'];
+      *aa++ = codon_aa[codon];
+      keep = aa;
+    }
+    *keep = 0;
+  }
+}
+
+/* Char at position pos of the strand being traced back.  */
+static inline unsigned char
+traceChar(scanner_p_t sc, seq_p_t seq, int pos)
+{
+  if (sc->stream)
+    return sc->sChar[pos - sc->sOff];
+  return strandChar(seq, pos, sc->reverse);
+}
+
+/* Keep the coding segment traced back into res up to r, whose edits
+   are in sc->edits up to e, as the start of the one going on past the
+   traced part, after the start kept so far if joined.  */
+static int
+streamHead(scanner_p_t sc, const unsigned char *res, const unsigned char *r,
+	   const unsigned int *e, int joined, int start, int score, int pad)
+{
+  size_t len = r - res;
+  size_t nEdits = e != NULL ? (size_t) (e - sc->edits) : 0;
+  if (!joined)
+    sc->hLen = sc->hEdits = 0;
+  if (sc->hMax < sc->hLen + len) {
+    size_t hMax = max(sc->hLen + len, 2 * sc->hMax);
+    if (resize(&sc->hChar, hMax) != 0)
+      return -1;
+    sc->hMax = hMax;
+  }
+  if (sc->hEditMax < sc->hEdits + nEdits) {
+    size_t hEditMax = max(sc->hEdits + nEdits, 2 * sc->hEditMax);
+    if (resize(&sc->hEdit, hEditMax * sizeof(unsigned int)) != 0)
+      return -1;
+    sc->hEditMax = hEditMax;
+  }
+  while (r > res)
+    sc->hChar[sc->hLen++] = *--r;
+  while (nEdits > 0)
+    sc->hEdit[sc->hEdits++] = sc->edits[--nEdits];
+  sc->hStart = start;
+  sc->hScore = score;
+  sc->hPad = pad;
+  return 0;
+}
+
+/* Trace back the best path of the strand of seq being scanned from state
+   *state at position pos, down to position low, and add its coding
+   segments to rc, last first.  Their best score goes to *maxScore if
+   larger.  If open, the path goes on past pos in the coding segment of
+   *state, which is kept by streamHead instead.  A segment going on
+   before low is joined to the one kept.  *state is then the state at
+   position low - 1.  Returns -1 on error.  */
+static int
+traceRange(scanner_p_t sc, seq_p_t seq, col_p_t rc, int pos, int *state,
+	   int low, int open, int *maxScore)
+{
+  layout_p_t l = &sc->l;
+  int results = sc->p.results;
+  int build = (results & (RES_SEQ | RES_PROT)) != 0;
+  size_t n = pos + 1 - low;
+  size_t hLen = sc->stream ? sc->hLen : 0;
+  size_t hEdits = sc->stream ? sc->hEdits : 0;
+  int iCurr = *state;
+  unsigned int f;
+
+  if (build && sc->traceMax < 2 * n + 4 + hLen) {
+    free(sc->trace);
+    sc->traceMax = 0;
+    if ((sc->trace = (unsigned char *) allocate(2 * n + 4 + hLen)) == NULL)
+      return -1;
+    sc->traceMax = 2 * n + 4 + hLen;
+  }
+  if ((results & RES_EDITS) && sc->editMax < n + hEdits) {
+    free(sc->edits);
+    sc->editMax = 0;
+    if ((sc->edits = (unsigned int *)
+	 allocate((n + hEdits) * sizeof(unsigned int))) == NULL)
+      return -1;
+    sc->editMax = n + hEdits;
+  }
+  while (pos >= low) {
+    int iOld = -1, rStart, rStop, pad, joined;
+    unsigned char *r;
+    unsigned int *e;
+    /* skip non coding */
+    while (pos >= low && !l->coding[iCurr]) {
+#ifdef DEBUG
+      fprintf(stderr, "trace back non-coding: state %d position %4d(%c)\n",
+	      iCurr, pos, traceChar(sc, seq, pos));
+#endif
+      iCurr = traceBack(sc, seq, pos, iCurr);
+      pos -= 1;
+    }
+    /* handle coding, which may end just before low in a streaming scan */
+    if (pos >= low || (low > 0 && l->coding[iCurr])) {
+      unsigned char *res = sc->trace;
+      int rScore = open ? 0 : scoreAt(sc, seq, pos, iCurr);
+      r = res;
+      e = sc->edits;
+      rStop = pos;
+      if (build && !open) {
+	if (l->frame[iCurr] == 0) {
+	  *r++ = 'X';
+	  *r++ = 'X';
+	}
+	if (l->frame[iCurr] == 1)
+	  *r++ = 'X';
+      }
+      while (pos >= low && l->coding[iCurr]) {
+	unsigned char c = traceChar(sc, seq, pos);
+	unsigned int edit = 0;
+	for (f = 0; f < 3; f++) {
+	  if (iCurr == l->iInsAfter[f])
+	    edit = 1;
+	  if (iCurr == l->iDelAfter[f])
+	    edit = EDIT_DEL;
+	}
+	if (build) {
+	  if (edit == 1)
+	    *r++ = tolower(c);
+	  else {
+	    *r++ = toupper(c);
+	    if (edit == EDIT_DEL)
+	      *r++ = 'X';
+	  }
+	}
+	if (edit != 0 && e != NULL)
+	  *e++ = edit == 1 ? (unsigned int) pos : pos | EDIT_DEL;
+	/* remove stop-profile penalty from coding score */
+	if (iCurr == l->iCds + 2 && iOld == l->iStop)
+	  rScore -= sc->p.tc3uPen;
+#ifdef DEBUG
+      fprintf(stderr, "trace back     coding: state %2d(%2d) position %4d(%c)\n",
+	      iCurr, l->frame[iCurr], pos, c);
+#endif
+	iOld = iCurr;
+	iCurr = traceBack(sc, seq, pos, iCurr);
+	pos -= 1;
+      }
+      joined = pos < low && low > 0 && l->coding[iCurr];
+      if (joined) {
+	if (iCurr == l->iCds + 2 && iOld == l->iStop)
+	  rScore -= sc->p.tc3uPen;
+	rStart = sc->hStart;
+	rScore += sc->hScore;
+	pad = sc->hPad;
+      } else {
+	rStart = pos + 1;
+	if (pos >= 0)
+	  rScore -= scoreAt(sc, seq, pos, iCurr);
+	pad = l->frame[iOld] == 1 ? 1 : l->frame[iOld] == 2 ? 2 : 0;
+	if (build) {
+	  if (pad >= 1)
+	    *r++ = 'X';
+	  if (pad == 2)
+	    *r++ = 'X';
+	}
+      }
+      if (open) {
+	if (streamHead(sc, res, r, e, joined, rStart, rScore, pad) != 0)
+	  return -1;
+	open = 0;
+	continue;
+      }
+      if (joined) {
+	size_t i;
+	for (i = hLen; build && i > 0; )
+	  *r++ = sc->hChar[--i];
+	for (i = hEdits; e != NULL && i > 0; )
+	  *e++ = sc->hEdit[--i];
+      }
+      if (rScore > *maxScore)
+	*maxScore = rScore;
+#ifdef DEBUG
+      fprintf(stderr, "found coding (reversed) %.*s, add to results, state %d \n",
+	      (int) (r - res), res, iCurr);
+#endif
+      if (rStop - rStart >= sc->p.minLen) {
+	size_t len = build ? (size_t) (r - res) : 0;
+	unsigned int nEdits = (results & RES_EDITS) ? e - sc->edits : 0;
+	result_p_t rp = newResult(rc, nEdits,
+				  (results & RES_SEQ) ? len + 1 : 0,
+				  (results & RES_PROT) ? len / 3 + 2 : 0);
+	unsigned int k;
+	if (rp == NULL)
+	  return -1;
+	rp->phase = (3 - pad) % 3;
+	rp->score = rScore;
+	rp->start = rStart;
+	rp->stop = rStop;
+	rp->reverse = sc->reverse;
+	for (k = 0; k < nEdits; k++)
+	  rp->edits[k] = e[-1 - (int) k];
+	if (build)
+	  setResultSeq(rp, res, len, results);
+      }
+    }
+  }
+  *state = iCurr;
+  return 0;
+}
+
+/* Trace back the best path of the strand of seq being scanned, once its
+   Viterbi and traceback tables are filled in, and add its coding
+   segments to rc.  */
+static int
+traceResults(scanner_p_t sc, seq_p_t seq, col_p_t rc, int *maxScore)
+{
+  int pos = seq->len - 1;
+  int bPrev, bScore;
+  const int *col = laneColumn(sc, blockRow(sc, seq, pos));
+  if (col == NULL)
+    return -1;
+  bPrev = bestEnd(sc, col, &bScore);
+  /* traceback and generate coding sequences starting from bPrev (confidence bScore) */
+  return traceRange(sc, seq, rc, pos, &bPrev, 0, 0, maxScore);
+}
+
+/* Scan the forward or reverse strand of seq, and add its coding
+   segments to rc.  *maxScore is raised to their best score.  Returns -1
+   on error, when rc may hold some of them.  */
+int
+Compute(scanner_p_t sc, seq_p_t seq, col_p_t rc, int reverse, int *maxScore)
+{
+  if (seq->len == 0)
+    return 0;
+  if (prepareScan(sc, seq) != 0)
+    return -1;
+  sc->reverse = reverse;
+  if (forward(sc, seq) != 0)
+    return -1;
+  return traceResults(sc, seq, rc, maxScore);
+}
+
+/* A parallel scan cuts the strand in segments of at least that many
+   blocks.  */
+#define PAR_MIN_BLOCKS 4
+
+typedef struct _par_arg_t {
+  par_p_t par;
+  unsigned int k;
+  void (*fn)(par_p_t, unsigned int);
+} par_arg_t;
+
+static void *
+parThread(void *arg)
+{
+  par_arg_t *a = (par_arg_t *) arg;
+  a->fn(a->par, a->k);
+  return NULL;
+}
+
+/* Run fn for each scanner k of par, in its own thread but for the first
+   one, and those whose thread could not be started.  */
+static void
+parRun(par_p_t par, void (*fn)(par_p_t, unsigned int))
+{
+  unsigned int k;
+  for (k = 1; k < par->n; k++) {
+    par->arg[k].par = par;
+    par->arg[k].k = k;
+    par->arg[k].fn = fn;
+    par->started[k] = pthread_create(par->tid + k, NULL, parThread,
+				     par->arg + k) == 0;
+  }
+  fn(par, 0);
+  for (k = 1; k < par->n; k++)
+    if (par->started[k])
+      pthread_join(par->tid[k], NULL);
+    else
+      fn(par, k);
+}
+
+/* Set the rolling indices for position pos from the chars preceding
+   it, of which they only depend on the last 2 * order.  */
+static void
+warmTindex(scanner_p_t sc, seq_p_t seq, unsigned int pos)
+{
+  unsigned int order = sc->M[MT_CODING]->order;
+  unsigned int p = pos > 2 * order ? pos - 2 * order : 0;
+  initTindex(sc);
+  for ( ; p < pos; p++)
+    rollTindex(order, sc->tableSize, &sc->tindex, sc->insTindex,
+	       sc->delTindex, GetCode(strandChar(seq, p, sc->reverse)),
+	       p == 0);
+}
+
+/* Start column of a run of parSegment: only the 5'UTR state with utr,
+   or else all the states but the 5'UTR and the 3'UTR.  */
+static void
+parStart(const layout_t *l, int *col, int utr)
+{
+  unsigned int s;
+  for (s = 0; s < l->states; s++)
+    col[s] = ((int) s == l->i5utr) == utr && (int) s != l->i3utr
+	     ? 0 : INT_MIN / 2;
+}
+
+/* Score at the end of the block of the rows in sc->V of the paths
+   entering the 3'UTR in the block, or about INT_MIN / 2, in *fresh, and
+   of the paths staying in it in *stay, given the column preceding the
+   block.  The 3'UTR leads to no other state.  */
+static void
+parUtr(scanner_p_t sc, const int *prev, unsigned int rows, int *fresh,
+       int *stay)
+{
+  layout_p_t l = &sc->l;
+  const int *cand = l->cand[4];
+  const int *ctrans = l->ctrans[4];
+  const int *curr = sc->V;
+  int f = INT_MIN / 2, t = 0, self = 0;
+  unsigned int i, r;
+  for (i = 0; i < l->nCand[4]; i++)
+    if (cand[i] == l->i3utr)
+      self = ctrans[i];
+  for (r = 0; r < rows; r++, prev = curr, curr += l->states) {
+    int enter = INT_MIN / 2, e;
+    for (i = 0; i < l->nCand[4]; i++)
+      if (cand[i] != l->i3utr)
+	enter = max(enter, prev[cand[i]] + ctrans[i]);
+    /* The emission score is what the column adds to the best one.  */
+    e = curr[l->i3utr] - max(prev[l->i3utr] + self, enter);
+    f = max(f + self, enter) + e;
+    t += self + e;
+  }
+  *fresh = f;
+  *stay = t;
+}
+
+/* Fill in the blocks of segment k with scanner sc, from the checkpoint
+   preceding them, saving the next ones, the 3'UTR scores of each block
+   in fresh and stay unless k is 0, and the last column in end.  */
+static void
+parBlocks(par_p_t par, scanner_p_t sc, unsigned int k, int *fresh, int *end)
+{
+  int *ckV = par->sc[0]->ckV;
+  unsigned int *ckT = par->sc[0]->ckTindex;
+  unsigned int states = sc->l.states;
+  unsigned int b;
+  for (b = par->first[k]; b < par->first[k + 1]; b++) {
+    if (b > par->first[k]) {
+      memcpy(ckV + (size_t) b * states,
+	     sc->V + (size_t) (sc->bLen - 1) * states, sizeof(int) * states);
+      saveTindex(sc, ckT + b * sc->ckTsize);
+    }
+    fillBlock(sc, par->seq, b);
+    if (k > 0)
+      parUtr(sc, ckV + (size_t) b * states,
+	     min(sc->bLen, par->seq->len - b * sc->bLen), fresh + b,
+	     par->stay + b);
+  }
+  if (k + 1 < par->n)
+    memcpy(end, sc->V + (size_t) (sc->bLen - 1) * states,
+	   sizeof(int) * states);
+}
+
+/* Run the Viterbi over segment k.  The first one starts from the first
+   char.  The others start from an unknown column, but the Viterbi only
+   adds and compares scores, so that the column of any position is the
+   max of those of runs from columns whose max is the unknown one, each
+   offset by a constant.  The runs are from the 5'UTR state, saved in the
+   checkpoints, and from the coding states, which mix fast, saved in ckC.
+   See parFix.  */
+static void
+parSegment(par_p_t par, unsigned int k)
+{
+  scanner_p_t sc = par->sc[k];
+  unsigned int states = sc->l.states;
+  unsigned int b0 = par->first[k], nb = par->first[k + 1] - b0;
+  int *ck = par->sc[0]->ckV + (size_t) b0 * states;
+  if (k == 0) {
+    parBlocks(par, sc, k, NULL, par->last);
+    return;
+  }
+  warmTindex(sc, par->seq, b0 * sc->bLen);
+  saveTindex(sc, par->sc[0]->ckTindex + b0 * sc->ckTsize);
+  parStart(&sc->l, ck, 0);
+  parBlocks(par, sc, k, par->cFresh, par->cLast + (size_t) k * states);
+  memcpy(par->ckC + (size_t) b0 * states, ck, sizeof(int) * nb * states);
+  parStart(&sc->l, ck, 1);
+  parBlocks(par, sc, k, par->uFresh, par->last + (size_t) k * states);
+}
+
+/* Find a and c such that column V is the max of U + a and C + c, but in
+   the 3'UTR, if any.  */
+static int
+parSplit(const layout_t *l, const int *V, const int *U, const int *C,
+	 int *a, int *c)
+{
+  unsigned int s;
+  *a = V[l->i5utr] - U[l->i5utr];
+  *c = INT_MAX;
+  for (s = 0; s < l->states; s++)
+    if ((int) s != l->i5utr && (int) s != l->i3utr && V[s] - C[s] < *c)
+      *c = V[s] - C[s];
+  for (s = 0; s < l->states; s++)
+    if ((int) s != l->i3utr && max(U[s] + *a, C[s] + *c) != V[s])
+      return 0;
+  return 1;
+}
+
+/* Turn column U into the max of U + a and C + c, with u in the
+   3'UTR.  */
+static void
+parJoin(const layout_t *l, int *U, const int *C, int a, int c, int u)
+{
+  unsigned int s;
+  for (s = 0; s < l->states; s++)
+    U[s] = max(U[s] + a, C[s] + c);
+  U[l->i3utr] = u;
+}
+
+/* Correct the segments in order, from the exact column ending the one
+   before.  Once the exact column preceding a block is split among the
+   runs of parSegment, the exact checkpoints which follow are joined from
+   theirs, the 3'UTR from the scores of its paths in each block.  Until
+   then, the blocks are filled in again from the exact columns, which
+   usually takes no more than one.  */
+static int
+parFix(par_p_t par)
+{
+  scanner_p_t sc = par->sc[0];
+  layout_p_t l = &sc->l;
+  unsigned int states = l->states;
+  int *start = (int *) allocate(2 * sizeof(int) * states);
+  unsigned int k, b;
+  if (start == NULL)
+    return -1;
+  parStart(l, start, 1);
+  parStart(l, start + states, 0);
+  for (k = 1; k < par->n; k++) {
+    unsigned int b0 = par->first[k], b1 = par->first[k + 1];
+    const int *in = par->last + (size_t) (k - 1) * states;
+    int a = 0, c = 0, u;
+    for (b = b0; b < b1; b++) {
+      int *ckV = sc->ckV + (size_t) b * states;
+      if (b == b0 ? parSplit(l, in, start, start + states, &a, &c)
+	  : parSplit(l, in, ckV, par->ckC + (size_t) b * states, &a, &c))
+	break;
+      memcpy(ckV, in, sizeof(int) * states);
+      fillBlock(sc, par->seq, b);
+      in = sc->V + (size_t) (sc->bLen - 1) * states;
+    }
+    if (b == b1) {
+      if (k + 1 < par->n)
+	memcpy(par->last + (size_t) k * states, in, sizeof(int) * states);
+      continue;
+    }
+    memcpy(sc->ckV + (size_t) b * states, in, sizeof(int) * states);
+    u = in[l->i3utr];
+    for ( ; b < b1; b++) {
+      u = max(u + par->stay[b],
+	      max(par->uFresh[b] + a, par->cFresh[b] + c));
+      if (b + 1 < b1)
+	parJoin(l, sc->ckV + (size_t) (b + 1) * states,
+		par->ckC + (size_t) (b + 1) * states, a, c, u);
+      else if (k + 1 < par->n)
+	parJoin(l, par->last + (size_t) k * states,
+		par->cLast + (size_t) k * states, a, c, u);
+    }
+  }
+  free(start);
+  return 0;
+}
+
+/* Fill in block wave[k] with scanner k, if any.  */
+static void
+parFill(par_p_t par, unsigned int k)
+{
+  if (par->wave[k] == UINT_MAX)
+    return;
+  fillBlock(par->sc[k], par->seq, par->wave[k]);
+  if (k > 0)
+    par->held[k] = par->wave[k];
+}
+
+/* Fill in block b of the first scanner of a parallel scan for its
+   traceback.  It is taken from the scanner which holds it, or else
+   filled in along with the blocks preceding it, one per scanner.  */
+static void
+parBlock(scanner_p_t sc, unsigned int b)
+{
+  par_p_t par = (par_p_t) sc->par;
+  scanner_p_t h;
+  unsigned int k;
+  int *V;
+  unsigned int *tr;
+  size_t maxSize;
+  unsigned int trMax;
+  for (k = 1; k < par->n && par->held[k] != b; k++)
+    ;
+  if (k == par->n) {
+    for (k = 0; k < par->n; k++)
+      par->wave[k] = b >= k ? b - k : UINT_MAX;
+    parRun(par, parFill);
+    return;
+  }
+  h = par->sc[k];
+  V = sc->V;
+  tr = sc->tr;
+  maxSize = sc->maxSize;
+  trMax = sc->trMax;
+  sc->V = h->V;
+  sc->tr = h->tr;
+  sc->maxSize = h->maxSize;
+  sc->trMax = h->trMax;
+  h->V = V;
+  h->tr = tr;
+  h->maxSize = maxSize;
+  h->trMax = trMax;
+  par->held[k] = UINT_MAX;
+  sc->bStart = b * sc->bLen;
+}
+
+/* Same as Compute, with the n scanners of sc, each in its own thread.
+   The strand is cut in n segments, whose Viterbi columns are computed
+   at once, each from an arbitrary start, and then corrected in order,
+   see parFix.  The blocks are then filled in again n at a time for the
+   traceback.  The scanners must share the matrices and parameters.  */
+int
+ComputeParallel(scanner_p_t *sc, unsigned int n, seq_p_t seq, col_p_t rc,
+		int reverse, int *maxScore)
+{
+  par_t par;
+  unsigned int bLen = 1, nb, k;
+  int res = 0;
+
+  if (seq->len == 0)
+    return 0;
+  while ((size_t) bLen * bLen < seq->len)
+    bLen += 1;
+  nb = (seq->len + bLen - 1) / bLen;
+  n = min(n, nb / PAR_MIN_BLOCKS);
+  if (n < 2)
+    return Compute(sc[0], seq, rc, reverse, maxScore);
+  par.sc = sc;
+  par.n = n;
+  par.seq = seq;
+  par.first = (unsigned int *) allocate((n + 1) * sizeof(unsigned int));
+  par.wave = (unsigned int *) allocate(n * sizeof(unsigned int));
+  par.held = (unsigned int *) allocate(n * sizeof(unsigned int));
+  par.tid = (pthread_t *) allocate(n * sizeof(pthread_t));
+  par.started = (int *) allocate(n * sizeof(int));
+  par.arg = (par_arg_t *) allocate(n * sizeof(par_arg_t));
+  par.last = par.ckC = par.cLast = NULL;
+  par.uFresh = par.cFresh = par.stay = NULL;
+  if (par.first == NULL || par.wave == NULL || par.held == NULL
+      || par.tid == NULL || par.started == NULL || par.arg == NULL)
+    res = -1;
+  for (k = 0; res == 0 && k < n; k++) {
+    sc[k]->bLen = bLen;
+    if (prepareScan(sc[k], seq) != 0
+	|| blockTables(sc[k], k == 0 ? nb : 0) != 0) {
+      res = -1;
+      break;
+    }
+    sc[k]->reverse = reverse;
+    par.first[k] = (unsigned int) ((unsigned long long) k * nb / n);
+    par.held[k] = UINT_MAX;
+  }
+  if (res == 0) {
+    par.first[n] = nb;
+    par.last = (int *) allocate(sizeof(int) * n * sc[0]->l.states);
+    par.ckC = (int *) allocate(sizeof(int) * nb * sc[0]->l.states);
+    par.cLast = (int *) allocate(sizeof(int) * n * sc[0]->l.states);
+    par.uFresh = (int *) allocate(nb * sizeof(int));
+    par.cFresh = (int *) allocate(nb * sizeof(int));
+    par.stay = (int *) allocate(nb * sizeof(int));
+    if (par.last == NULL || par.ckC == NULL || par.cLast == NULL
+	|| par.uFresh == NULL || par.cFresh == NULL || par.stay == NULL)
+      res = -1;
+  }
+  if (res == 0) {
+    for (k = 0; k < n; k++)
+      sc[k]->par = &par;
+    parRun(&par, parSegment);
+    res = parFix(&par);
+  }
+  if (res == 0) {
+    /* Have the traceback fill in the last block first.  */
+    sc[0]->bStart = nb * bLen;
+    res = traceResults(sc[0], seq, rc, maxScore);
+  }
+  for (k = 0; k < n; k++)
+    sc[k]->par = NULL;
+  free(par.first);
+  free(par.last);
+  free(par.ckC);
+  free(par.cLast);
+  free(par.uFresh);
+  free(par.cFresh);
+  free(par.stay);
+  free(par.wave);
+  free(par.held);
+  free(par.tid);
+  free(par.started);
+  free(par.arg);
+  return res;
+}
+
+/* Columns of a streaming scan between two checkpoints.  */
+#define STREAM_BLOCK 1024
+
+/* Remove the results of rc from first to end.  */
+static void
+dropResults(col_p_t rc, unsigned int first, unsigned int end)
+{
+  unsigned int i;
+  if (rc->arena == NULL)
+    for (i = first; i < end; i++) {
+      result_p_t r = rc->e.r[i];
+      free(r->s);
+      free(r->aa);
+      free(r->edits);
+      free(r);
+    }
+  memmove(rc->e.r + first, rc->e.r + end, (rc->nb - end) * sizeof(result_p_t));
+  rc->nb -= end - first;
+}
+
+static void
+reverseResults(col_p_t rc, unsigned int first, unsigned int end)
+{
+  while (first + 1 < end) {
+    result_p_t r = rc->e.r[first];
+    rc->e.r[first++] = rc->e.r[--end];
+    rc->e.r[end] = r;
+  }
+}
+
+/* Make room for the chars and traceback words of the next block of a
+   streaming scan, and for the checkpoint of the one after it.  Those
+   before sKeep are dropped once there are as many as kept, else the
+   buffers grow.  */
+static int
+streamRoom(scanner_p_t sc)
+{
+  unsigned int states = sc->l.states;
+  size_t need = sc->sEnd + STREAM_BLOCK - sc->sOff;
+  size_t blocks;
+  if (need > sc->sMax && sc->sKeep > sc->sOff
+      && sc->sKeep - sc->sOff >= sc->sEnd - sc->sKeep) {
+    unsigned int drop = sc->sKeep - sc->sOff;
+    unsigned int keep = sc->sEnd - sc->sKeep;
+    /* The checkpoint of block sEnd / STREAM_BLOCK is there already.  */
+    unsigned int bDrop = drop / STREAM_BLOCK;
+    unsigned int bKeep = keep / STREAM_BLOCK + 1;
+    memmove(sc->sChar, sc->sChar + drop, keep);
+    memmove(sc->sTr, sc->sTr + drop, keep * sizeof(unsigned int));
+    memmove(sc->ckV, sc->ckV + (size_t) bDrop * states,
+	    (size_t) bKeep * states * sizeof(int));
+    memmove(sc->ckTindex, sc->ckTindex + bDrop * sc->ckTsize,
+	    bKeep * sc->ckTsize * sizeof(unsigned int));
+    sc->sOff = sc->sKeep;
+    need = sc->sEnd + STREAM_BLOCK - sc->sOff;
+  }
+  if (need > sc->sMax) {
+    size_t sMax = max(need, 2 * sc->sMax);
+    if (resize(&sc->sChar, sMax) != 0
+	|| resize(&sc->sTr, sMax * sizeof(unsigned int)) != 0)
+      return -1;
+    sc->sMax = sMax;
+  }
+  blocks = sc->sMax / STREAM_BLOCK + 1;
+  if (sc->ckVMax < blocks * states) {
+    if (resize(&sc->ckV, sizeof(int) * blocks * states) != 0)
+      return -1;
+    sc->ckVMax = blocks * states;
+  }
+  if (sc->ckTMax < blocks * sc->ckTsize) {
+    if (resize(&sc->ckTindex, sizeof(unsigned int) * blocks * sc->ckTsize)
+	!= 0)
+      return -1;
+    sc->ckTMax = blocks * sc->ckTsize;
+  }
+  return 0;
+}
+
+/* Trace back the best path from state iCurr at position pos down to
+   sBase, and keep its results, in order, after those found before sBase
+   if it goes through sAnchor, or else instead of them.  If open, the
+   path goes on past pos.  */
+static int
+streamTrace(scanner_p_t sc, seq_p_t seq, col_p_t rc, int pos, int iCurr,
+	    int open)
+{
+  unsigned int first = rc->nb;
+  int best = INT_MIN;
+  if (traceRange(sc, seq, rc, pos, &iCurr, sc->sBase, open, &best) != 0)
+    return -1;
+  if (iCurr != sc->sAnchor) {
+    dropResults(rc, sc->sFirst, first);
+    first = sc->sFirst;
+    sc->sBest = INT_MIN;
+  }
+  if (best > sc->sBest)
+    sc->sBest = best;
+  reverseResults(rc, first, rc->nb);
+  return 0;
+}
+
+/* Find the last position where the best paths to all the states, but
+   those still in the 5'UTR, go through the same state.  The path before
+   it is the one of the final best path, unless that one stays in the
+   5'UTR, so that its results are kept and the columns before it are
+   dropped.  */
+static int
+streamResolve(scanner_p_t sc, seq_p_t seq, col_p_t rc)
+{
+  layout_p_t l = &sc->l;
+  int *set = sc->sSet;
+  int *next = set + l->states;
+  int *mark = next + l->states;
+  int pos = sc->sEnd - 1;
+  unsigned int n = 0, m, k, s;
+  for (s = 0; s < l->states; s++)
+    if ((int) s != l->i5utr)
+      set[n++] = s;
+  while (n > 1 && pos >= (int) sc->sBase) {
+    unsigned int w = sc->sTr[pos - sc->sOff];
+    int *t;
+    for (k = m = 0; pos > 0 && k < n; k++) {
+      int p = prevState(l, w, set[k]);
+      if (p != l->i5utr && !mark[p]) {
+	mark[p] = 1;
+	next[m++] = p;
+      }
+    }
+    for (k = 0; k < m; k++)
+      mark[next[k]] = 0;
+    t = set;
+    set = next;
+    next = t;
+    n = m;
+    pos -= 1;
+  }
+  if (n == 1 && pos >= (int) sc->sBase) {
+    if (streamTrace(sc, seq, rc, pos, set[0], l->coding[set[0]]) != 0)
+      return -1;
+    sc->sAnchor = set[0];
+    sc->sBase = pos + 1;
+  } else if (n == 0 && pos >= (int) sc->sBase) {
+    /* All the paths are in the 5'UTR at pos.  */
+    dropResults(rc, sc->sFirst, rc->nb);
+    sc->sBest = INT_MIN;
+    sc->sAnchor = l->i5utr;
+    sc->sBase = pos + 1;
+  }
+  if (sc->sBase > 0)
+    sc->sKeep = (sc->sBase - 1) / STREAM_BLOCK * STREAM_BLOCK;
+  /* Wait longer each time the unresolved part grows.  */
+  sc->sCheck = sc->sEnd + max(STREAM_BLOCK, sc->sEnd - sc->sBase);
+  return 0;
+}
+
+/* Same as Compute, but the strand is read block by block as the Viterbi
+   goes, and the path is traced back as soon as the best paths to all the
+   states meet, so that only the columns since then are kept.  The
+   results are the same, in the same order.  */
+int
+ComputeStream(scanner_p_t sc, seq_p_t seq, col_p_t rc, int reverse,
+	      int *maxScore)
+{
+  unsigned int states;
+  size_t at = 0;
+  int pos, bPrev, bScore;
+
+  if (seq->len == 0)
+    return 0;
+  if (prepareScan(sc, seq) != 0)
+    return -1;
+  states = sc->l.states;
+  sc->reverse = reverse;
+  sc->bLen = STREAM_BLOCK;
+  sc->lanes = 1;
+  sc->lane = 0;
+  sc->narrow = 0;
+  sc->ckTsize = 2 * sc->M[MT_CODING]->order;
+  if (sc->maxSize < sizeof(int) * STREAM_BLOCK * states) {
+    if (resize(&sc->V, sizeof(int) * STREAM_BLOCK * states) != 0)
+      return -1;
+    sc->maxSize = sizeof(int) * STREAM_BLOCK * states;
+  }
+  if (sc->sSetMax < 3 * states) {
+    if (resize(&sc->sSet, 3 * states * sizeof(int)) != 0)
+      return -1;
+    sc->sSetMax = 3 * states;
+  }
+  memset(sc->sSet + 2 * states, 0, states * sizeof(int));
+  sc->stream = 1;
+  sc->sOff = sc->sKeep = sc->sBase = sc->sEnd = 0;
+  sc->sCheck = STREAM_BLOCK;
+  sc->sAnchor = sc->l.iBegin;
+  sc->sFirst = rc->nb;
+  sc->sBest = INT_MIN;
+  sc->hLen = sc->hEdits = 0;
+  while (sc->sEnd < seq->len) {
+    unsigned int b = sc->sEnd / STREAM_BLOCK;
+    unsigned int n = min(seq->len - sc->sEnd, STREAM_BLOCK);
+    if (streamRoom(sc) != 0) {
+      sc->stream = 0;
+      return -1;
+    }
+    if (seq_read_strand(seq, reverse, &at, sc->sChar + (sc->sEnd - sc->sOff),
+			n) != n) {
+      sc->stream = 0;
+      return failed("Sequence %s changed while scanned\n", seq->header);
+    }
+    fillBlock(sc, seq, b);
+    sc->sEnd += n;
+    if (sc->sEnd < seq->len) {
+      unsigned int ck = (sc->sEnd - sc->sOff) / STREAM_BLOCK;
+      memcpy(sc->ckV + (size_t) ck * states,
+	     sc->V + (size_t) (STREAM_BLOCK - 1) * states,
+	     sizeof(int) * states);
+      saveTindex(sc, sc->ckTindex + ck * sc->ckTsize);
+      if (sc->sEnd >= sc->sCheck && streamResolve(sc, seq, rc) != 0) {
+	sc->stream = 0;
+	return -1;
+      }
+    }
+  }
+  pos = seq->len - 1;
+  bPrev = bestEnd(sc, laneColumn(sc, blockRow(sc, seq, pos)), &bScore);
+  if (streamTrace(sc, seq, rc, pos, bPrev, 0) != 0) {
+    sc->stream = 0;
+    return -1;
+  }
+  /* The results of Compute come last first.  */
+  reverseResults(rc, sc->sFirst, rc->nb);
+  sc->stream = 0;
+  *maxScore = max(*maxScore, sc->sBest);
+  return 0;
+}
+
+#ifdef __GNUC__
+/* Same as branchMax, for all lanes at once, the best score goes in v.  */
+static inline ALWAYS_INLINE void
+branchMaxBatch(const layout_t *l, unsigned int b, const vint_t *prevV,
+	       vint_t *v, vuint_t *w)
+{
+  const int *c = l->cand[b];
+  const int *t = l->ctrans[b];
+  vint_t bScore = prevV[c[0]] + t[0];
+  vint_t bCode = { 0 };
+  unsigned int k;
+  for (k = 1; k < l->nCand[b]; k++) {
+    vint_t score = prevV[c[k]] + t[k];
+    vint_t better = score > bScore;
+    bScore = (score & better) | (bScore & ~better);
+    bCode = ((int) k & better) | (bCode & ~better);
+  }
+  *w |= (vuint_t) bCode << l->bShift[b];
+  *v = bScore;
+}
+
+/* Update the rolling indices t of one lane for the char of the given
+   code, as the emit kernels do, or set them up for the first char, and
+   store the emission score of each state s in E[s * BATCH_LANES].  */
+static inline ALWAYS_INLINE void
+laneScores(const scanner_t *sc, unsigned int *t, unsigned int code,
+	   int first, int *E, unsigned int order, unsigned int startlen,
+	   unsigned int stoplen)
+{
+  SHAPE_INDICES(order, startlen, stoplen);
+  const int *start = sc->M[MT_START]->byCode + code * startlen;
+  const int *stop = sc->M[MT_STOP]->byCode + code * stoplen;
+  unsigned int *insTindex = t + 1;
+  unsigned int *delTindex = insTindex + order;
+  unsigned int i;
+  if (first) {
+    for (i = 0; i < order; i++)
+      insTindex[i] = delTindex[i] = sc->tableSize - 1;
+    t[0] = sc->tableSize - 1;
+  }
+  rollTindex(order, sc->tableSize, t, insTindex, delTindex, code, first);
+  emitRow(sc, t[0], insTindex, delTindex, E, BATCH_LANES,
+	  order, startlen, stoplen);
+  for (i = 0; i < startlen; i++)
+    E[(1 + i) * BATCH_LANES] = start[i];
+  for (i = 0; i < stoplen; i++)
+    E[(iStop + i) * BATCH_LANES] = stop[i];
+}
+
+/* Fill in the Viterbi and traceback tables of the BATCH_LANES sequences
+   of seqs, NULL for unused lanes, over the first len positions of strand
+   rev[k] of lane k.  Each
+   lane computes exactly what firstColumn and nextColumn do.  The
+   emission scores of a column are looked up lane by lane first, then
+   all lanes are updated together.  */
+static inline ALWAYS_INLINE void
+batchForwardShape(scanner_p_t sc, seq_p_t *seqs, const int *rev,
+		  unsigned int len, unsigned int order, unsigned int startlen,
+		  unsigned int stoplen)
+{
+  SHAPE_INDICES(order, startlen, stoplen);
+  layout_p_t l = &sc->l;
+  unsigned int tsize = 1 + 2 * order;
+  const vint_t *E = (const vint_t *) sc->bE;
+  vint_t *currV = (vint_t *) sc->V;
+  vuint_t *currTr = (vuint_t *) sc->tr;
+  const vint_t *prevV;
+  unsigned int pos, k, f, s;
+
+  for (k = 0; k < BATCH_LANES; k++) {
+    unsigned char c = seqs[k] != NULL ? strandChar(seqs[k], 0, rev[k]) : 'N';
+    laneScores(sc, sc->bTindex + k * tsize, GetCode(c), 1, sc->bE + k,
+	       order, startlen, stoplen);
+  }
+  currV[0] = E[0] + sc->p.ts5uPen;
+  for (s = 1; s < iCds; s++)
+    currV[s] = E[s] + sc->p.min;
+  for (s = iCds; s < iStop; s++)
+    currV[s] = E[s] + sc->p.tscPen;
+  for (s = iStop; s < i3utr; s++)
+    currV[s] = E[s] + sc->p.min;
+  currV[i3utr] = E[i3utr] + sc->p.ts3uPen;
+  for (s = i3utr + 1; s < states; s++)
+    currV[s] = (vint_t) { 0 } + INT_MIN / 2;
+  *currTr = (vuint_t) { 0 };
+
+  for (pos = 1; pos < len; pos++) {
+    vuint_t w = { 0 };
+    prevV = currV;
+    currV += states;
+    currTr += 1;
+    /* Lanes past the end of their sequence are left as they are.  */
+    for (k = 0; k < BATCH_LANES; k++)
+      if (seqs[k] != NULL && pos < seqs[k]->len)
+	laneScores(sc, sc->bTindex + k * tsize,
+		   GetCode(strandChar(seqs[k], pos, rev[k])), 0, sc->bE + k,
+		   order, startlen, stoplen);
+    /* transitions UTR->UTR and CDS->CDS are presumed zero */
+    currV[0] = prevV[0] + E[0];
+    currV[1] = prevV[0] + sc->p.t5ucPen + E[1];
+    for (s = 2; s < iCds; s++)
+      currV[s] = prevV[s - 1] + E[s];
+    for (f = 0; f < 3; f++) {
+      branchMaxBatch(l, f, prevV, currV + iCds + f, &w);
+      currV[iCds + f] += E[iCds + f];
+    }
+    branchMaxBatch(l, 3, prevV, currV + iStop, &w);
+    currV[iStop] += E[iStop];
+    for (s = iStop + 1; s < i3utr; s++)
+      currV[s] = prevV[s - 1] + E[s];
+    branchMaxBatch(l, 4, prevV, currV + i3utr, &w);
+    currV[i3utr] += E[i3utr];
+    /* The insertion and deletion chains follow each other.  */
+    for (s = iIns0 + 1; s < states; s++)
+      currV[s] = prevV[s - 1] + E[s];
+    for (f = 0; f < 3; f++) {
+      currV[iIns0 + f * order] = prevV[iCds + f] + sc->p.iPen;
+      currV[iDel0 + f * (order - 1)] = prevV[iCds + f] + sc->p.dPen
+				       + E[iDel0 + f * (order - 1)];
+    }
+    *currTr = w;
+  }
+}
+
+#ifdef HAVE_NARROW
+/* Bounds of the scores of a narrow batch, checked every NARROW_EVERY
+   columns.  A lane is rebased once its best score passes NARROW_HIGH,
+   and gives up when one of its scores falls below NARROW_LOW.  With
+   penalties of at most NARROW_PEN, a score moves by less than
+   NARROW_STEP per column, so that no score leaves the short range
+   between two checks.  */
+#define NARROW_EVERY 8
+#define NARROW_PEN 512
+#define NARROW_STEP (NARROW_PEN + 128)
+#define NARROW_HIGH (SHRT_MAX - NARROW_EVERY * NARROW_STEP)
+#define NARROW_LOW (SHRT_MIN + NARROW_EVERY * NARROW_STEP)
+/* Minus infinity for the states out of reach at the first position.
+   These are the insertion and deletion chains, which get only emission
+   scores until they fill up with reachable scores after order columns.
+   Until the first check no real score comes near it.  */
+#define NARROW_NEG (SHRT_MIN + 4096)
+
+/* Whether the scores fit a narrow batch until the first check, whatever
+   the sequences.  */
+static int
+narrowOk(const params_t *p, const matrix_p_t *M)
+{
+  int pen[11];
+  unsigned int i;
+  pen[0] = p->min;
+  pen[1] = p->dPen;
+  pen[2] = p->iPen;
+  pen[3] = p->ts5uPen;
+  pen[4] = p->tscPen;
+  pen[5] = p->ts3uPen;
+  pen[6] = p->t5ucPen;
+  pen[7] = p->tc3uPen;
+  pen[8] = p->t5uePen;
+  pen[9] = p->tcePen;
+  pen[10] = p->t3uePen;
+  for (i = 0; i < 11; i++)
+    if (pen[i] < -NARROW_PEN || pen[i] > NARROW_PEN)
+      return 0;
+  return M[MT_CODING]->order <= 16;
+}
+
+/* Same as branchMaxBatch, for a narrow batch.  */
+static inline ALWAYS_INLINE void
+branchMaxNarrow(const layout_t *l, unsigned int b, const vshort_t *prevV,
+		vshort_t *v, vuint_t *w)
+{
+  const int *c = l->cand[b];
+  const int *t = l->ctrans[b];
+  vshort_t bScore = prevV[c[0]] + (short) t[0];
+  vshort_t bCode = { 0 };
+  unsigned int k;
+  for (k = 1; k < l->nCand[b]; k++) {
+    vshort_t score = prevV[c[k]] + (short) t[k];
+    vshort_t better = score > bScore;
+    bScore = (score & better) | (bScore & ~better);
+    bCode = ((short) k & better) | (bCode & ~better);
+  }
+  *w |= __builtin_convertvector(bCode, vuint_t) << l->bShift[b];
+  *v = bScore;
+}
+
+/* Same as batchForward, for a narrow batch.  The scores of each column
+   of lane k are stored relative to sc->off[pos * BATCH_LANES + k].
+   Lanes whose scores do not fit are flagged in bad.  */
+static inline ALWAYS_INLINE void
+batchForwardNarrowShape(scanner_p_t sc, seq_p_t *seqs, const int *rev,
+			unsigned int len, int *bad, unsigned int order,
+			unsigned int startlen, unsigned int stoplen)
+{
+  SHAPE_INDICES(order, startlen, stoplen);
+  layout_p_t l = &sc->l;
+  unsigned int tsize = 1 + 2 * order;
+  const vint_t *E = (const vint_t *) sc->bE;
+  vshort_t *currV = (vshort_t *) sc->V;
+  vuint_t *currTr = (vuint_t *) sc->tr;
+  vint_t *off = (vint_t *) sc->off;
+  vint_t lens, fail = { 0 };
+  const vshort_t *prevV;
+  unsigned int pos, k, f, s;
+
+  for (k = 0; k < BATCH_LANES; k++) {
+    unsigned char c = seqs[k] != NULL ? strandChar(seqs[k], 0, rev[k]) : 'N';
+    lens[k] = seqs[k] != NULL ? (int) seqs[k]->len : 0;
+    laneScores(sc, sc->bTindex + k * tsize, GetCode(c), 1, sc->bE + k,
+	       order, startlen, stoplen);
+  }
+  for (s = 0; s <= i3utr; s++)
+    currV[s] = __builtin_convertvector(E[s], vshort_t);
+  currV[0] += (short) sc->p.ts5uPen;
+  for (s = 1; s < iCds; s++)
+    currV[s] += (short) sc->p.min;
+  for (s = iCds; s < iStop; s++)
+    currV[s] += (short) sc->p.tscPen;
+  for (s = iStop; s < i3utr; s++)
+    currV[s] += (short) sc->p.min;
+  currV[i3utr] += (short) sc->p.ts3uPen;
+  for (s = i3utr + 1; s < states; s++)
+    currV[s] = (vshort_t) { 0 } + (short) NARROW_NEG;
+  *currTr = (vuint_t) { 0 };
+  *off = (vint_t) { 0 };
+
+  for (pos = 1; pos < len; pos++) {
+    vuint_t w = { 0 };
+    prevV = currV;
+    currV += states;
+    currTr += 1;
+    off += 1;
+    *off = off[-1];
+    for (k = 0; k < BATCH_LANES; k++)
+      if (seqs[k] != NULL && pos < seqs[k]->len)
+	laneScores(sc, sc->bTindex + k * tsize,
+		   GetCode(strandChar(seqs[k], pos, rev[k])), 0, sc->bE + k,
+		   order, startlen, stoplen);
+    /* transitions UTR->UTR and CDS->CDS are presumed zero */
+    currV[0] = prevV[0] + __builtin_convertvector(E[0], vshort_t);
+    currV[1] = prevV[0] + (short) sc->p.t5ucPen
+	       + __builtin_convertvector(E[1], vshort_t);
+    for (s = 2; s < iCds; s++)
+      currV[s] = prevV[s - 1] + __builtin_convertvector(E[s], vshort_t);
+    for (f = 0; f < 3; f++) {
+      branchMaxNarrow(l, f, prevV, currV + iCds + f, &w);
+      currV[iCds + f] += __builtin_convertvector(E[iCds + f], vshort_t);
+    }
+    branchMaxNarrow(l, 3, prevV, currV + iStop, &w);
+    currV[iStop] += __builtin_convertvector(E[iStop], vshort_t);
+    for (s = iStop + 1; s < i3utr; s++)
+      currV[s] = prevV[s - 1] + __builtin_convertvector(E[s], vshort_t);
+    branchMaxNarrow(l, 4, prevV, currV + i3utr, &w);
+    currV[i3utr] += __builtin_convertvector(E[i3utr], vshort_t);
+    /* The insertion and deletion chains follow each other.  */
+    for (s = iIns0 + 1; s < states; s++)
+      currV[s] = prevV[s - 1] + __builtin_convertvector(E[s], vshort_t);
+    for (f = 0; f < 3; f++) {
+      currV[iIns0 + f * order] = prevV[iCds + f] + (short) sc->p.iPen;
+      currV[iDel0 + f * (order - 1)] = prevV[iCds + f] + (short) sc->p.dPen
+	+ __builtin_convertvector(E[iDel0 + f * (order - 1)], vshort_t);
+    }
+    *currTr = w;
+    /* Keep the scores in range, once all states are reachable.  */
+    if (pos % NARROW_EVERY == 0 && pos > order) {
+      vshort_t hi = currV[0], lo = currV[0], shift;
+      for (s = 1; s < states; s++) {
+	vshort_t more = currV[s] > hi, less = currV[s] < lo;
+	hi = (currV[s] & more) | (hi & ~more);
+	lo = (currV[s] & less) | (lo & ~less);
+      }
+      shift = hi & (hi > (short) NARROW_HIGH);
+      for (k = 0; k < BATCH_LANES; k++)
+	if (shift[k] != 0) {
+	  for (s = 0; s < states; s++)
+	    currV[s] -= shift;
+	  *off += __builtin_convertvector(shift, vint_t);
+	  break;
+	}
+      fail |= (__builtin_convertvector(lo, vint_t)
+	       - __builtin_convertvector(shift, vint_t) < NARROW_LOW)
+	      & (lens > (int) pos);
+    }
+  }
+  for (k = 0; k < BATCH_LANES; k++)
+    bad[k] = fail[k] != 0;
+}
+#endif
+#endif
+
+/* Instantiate the kernels called name for the given shape, constants or
+   expressions of sc.  */
+#define SCAN_KERNELS(name, order, startlen, stoplen)			\
+static void								\
+name##Emit(scanner_p_t sc, const unsigned char *s, unsigned int pos,	\
+	   unsigned int n)						\
+{									\
+  emitScoresShape(sc, s, pos, n, order, startlen, stoplen);		\
+}									\
+static void SIMD_CLONES							\
+name##Column(scanner_p_t sc, unsigned int code, const int *E,		\
+	     const int *prevV, int *currV, unsigned int *currTr)	\
+{									\
+  nextColumnShape(sc, code, E, prevV, currV, currTr,			\
+		  order, startlen, stoplen);				\
+}
+#ifdef __GNUC__
+#define BATCH_KERNELS(name, order, startlen, stoplen)			\
+static void SIMD_CLONES							\
+name##Batch(scanner_p_t sc, seq_p_t *seqs, const int *rev,		\
+	    unsigned int len)						\
+{									\
+  batchForwardShape(sc, seqs, rev, len, order, startlen, stoplen);	\
+}
+#else
+#define BATCH_KERNELS(name, order, startlen, stoplen)
+#endif
+#ifdef HAVE_NARROW
+#define NARROW_KERNELS(name, order, startlen, stoplen)			\
+static void SIMD_CLONES							\
+name##Narrow(scanner_p_t sc, seq_p_t *seqs, const int *rev,		\
+	     unsigned int len, int *bad)				\
+{									\
+  batchForwardNarrowShape(sc, seqs, rev, len, bad,			\
+			  order, startlen, stoplen);			\
+}
+#define KERNELS_ENTRY(name, order, startlen, stoplen)			\
+  { order, startlen, stoplen, name##Emit, name##Column, name##Batch,	\
+    name##Narrow }
+#elif defined(__GNUC__)
+#define NARROW_KERNELS(name, order, startlen, stoplen)
+#define KERNELS_ENTRY(name, order, startlen, stoplen)			\
+  { order, startlen, stoplen, name##Emit, name##Column, name##Batch }
+#else
+#define NARROW_KERNELS(name, order, startlen, stoplen)
+#define KERNELS_ENTRY(name, order, startlen, stoplen)			\
+  { order, startlen, stoplen, name##Emit, name##Column }
+#endif
+#define KERNELS(name, order, startlen, stoplen)				\
+  SCAN_KERNELS(name, order, startlen, stoplen)				\
+  BATCH_KERNELS(name, order, startlen, stoplen)				\
+  NARROW_KERNELS(name, order, startlen, stoplen)
+
+/* The shapes of the human model, for low and high C+G content.  */
+KERNELS(shape6x18, 6, 18, 18)
+KERNELS(shape4x12, 4, 12, 12)
+KERNELS(generic, sc->M[MT_CODING]->order, sc->M[MT_START]->frames,
+	sc->M[MT_STOP]->frames)
+
+/* The generic kernels come last, and match any shape.  */
+static const kernels_t kernels[] = {
+  KERNELS_ENTRY(shape6x18, 6, 18, 18),
+  KERNELS_ENTRY(shape4x12, 4, 12, 12),
+  KERNELS_ENTRY(generic, 0, 0, 0)
+};
+
+static const kernels_t *
+shapeKernels(const matrix_p_t *M)
+{
+  const kernels_t *k = kernels;
+  while (k->order != 0
+	 && (k->order != M[MT_CODING]->order
+	     || k->startlen != M[MT_START]->frames
+	     || k->stoplen != M[MT_STOP]->frames))
+    k += 1;
+  return k;
+}
+
+#ifdef __GNUC__
+/* Scan the n sequences of seqs, which share the same matrices and are
+   at most len long, in the lanes of one batch, narrow if asked.  Lane k
+   reads strand rev[k] of seqs[k].  The sequences which did not fit a
+   narrow batch are flagged in bad, and left unscanned.  So are the
+   other strands of the same results, which keeps them in order.
+   Returns their number, or -1 on error.  */
+static int
+batchScan(scanner_p_t sc, seq_p_t *seqs, const int *rev, unsigned int n,
+	  unsigned int len, col_p_t *rc, int *maxScore, int narrow, int *bad)
+{
+  size_t cell = narrow ? sizeof(short) : sizeof(int);
+  seq_p_t lanes[BATCH_LANES];
+  int laneRev[BATCH_LANES];
+  unsigned int states, k, j;
+  int nBad = 0;
+  size_t mSize;
+  if (prepareScan(sc, seqs[0]) != 0)
+    return -1;
+  states = sc->l.states;
+  mSize = cell * (size_t) len * states * BATCH_LANES;
+  if (sc->maxSize < mSize) {
+    if (resize(&sc->V, mSize) != 0)
+      return -1;
+    sc->maxSize = mSize;
+  }
+  if (sc->trMax < len * BATCH_LANES) {
+    if (resize(&sc->tr, sizeof(unsigned int) * len * BATCH_LANES) != 0)
+      return -1;
+    sc->trMax = len * BATCH_LANES;
+  }
+  if (sc->bTMax < (1 + 2 * sc->maxOrder) * BATCH_LANES) {
+    unsigned int bTMax = (1 + 2 * sc->maxOrder) * BATCH_LANES;
+    if (resize(&sc->bTindex, sizeof(unsigned int) * bTMax) != 0)
+      return -1;
+    sc->bTMax = bTMax;
+  }
+  if (sc->bEMax < states * BATCH_LANES) {
+    if (resize(&sc->bE, sizeof(int) * states * BATCH_LANES) != 0)
+      return -1;
+    sc->bEMax = states * BATCH_LANES;
+  }
+  for (k = 0; k < BATCH_LANES; k++) {
+    lanes[k] = k < n ? seqs[k] : NULL;
+    laneRev[k] = k < n ? rev[k] : 0;
+    bad[k] = 0;
+  }
+#ifdef HAVE_NARROW
+  if (narrow) {
+    if (sc->offMax < len * BATCH_LANES) {
+      if (resize(&sc->off, sizeof(int) * len * BATCH_LANES) != 0)
+	return -1;
+      sc->offMax = len * BATCH_LANES;
+    }
+    sc->kern->narrow(sc, lanes, laneRev, len, bad);
+    for (k = 0; k < n; k++)
+      if (bad[k])
+	for (j = 0; j < n; j++)
+	  if (rc[j] == rc[k])
+	    bad[j] = 1;
+  } else
+#endif
+    sc->kern->batch(sc, lanes, laneRev, len);
+  sc->lanes = BATCH_LANES;
+  sc->narrow = narrow;
+  sc->bStart = 0;
+  sc->bLen = len;
+  for (k = 0; k < n; k++) {
+    if (bad[k]) {
+      nBad += 1;
+      continue;
+    }
+    sc->lane = k;
+    sc->reverse = rev[k];
+    if (traceResults(sc, seqs[k], rc[k], maxScore + k) != 0)
+      return -1;
+  }
+  return nBad;
+}
+#endif
+
+/* Batch element, sorted by matrices then decreasing length, the forward
+   strand of each sequence first.  */
+typedef struct _batch_elt_t {
+  matrix_p_t M[MT_COUNT];
+  seq_p_t seq;
+  unsigned int i;
+  int rev;
+} batch_elt_t, *batch_elt_p_t;
+
+static int
+batchCompare(const void *a, const void *b)
+{
+  const batch_elt_t *ea = (const batch_elt_t *) a;
+  const batch_elt_t *eb = (const batch_elt_t *) b;
+  int c = memcmp(ea->M, eb->M, sizeof(ea->M));
+  if (c != 0)
+    return c;
+  if (ea->seq->len != eb->seq->len)
+    return ea->seq->len < eb->seq->len ? 1 : -1;
+  if (ea->i != eb->i)
+    return ea->i < eb->i ? -1 : 1;
+  return ea->rev - eb->rev;
+}
+
+/* Same as calling Compute on the forward strand of each of the n
+   sequences of seqs, and then on the reverse one when strands is 2,
+   with results in rc[i] and running maximum in maxScore[i].  Strands of
+   similar length which use the same matrices are scanned together in
+   the lanes of a batch, so that both strands of a sequence usually
+   share one.  Returns -1 on error.  */
+int
+ComputeBatch(scanner_p_t sc, seq_p_t *seqs, unsigned int n, col_p_t *rc,
+	     int strands, int *maxScore)
+{
+  batch_elt_p_t e = (batch_elt_p_t)
+    allocate(strands * n * sizeof(batch_elt_t));
+  unsigned int i, j, nb = 0;
+  int r, res = 0;
+  if (e == NULL)
+    return -1;
+  for (i = 0; i < n; i++) {
+    if (seqs[i]->len == 0)
+      continue;
+    for (r = 0; r < strands; r++) {
+      if (SelectMatrices(sc->mc, seqs[i], e[nb].M) != 0) {
+	free(e);
+	return -1;
+      }
+      e[nb].seq = seqs[i];
+      e[nb].i = i;
+      e[nb].rev = r;
+      nb += 1;
+    }
+  }
+  qsort(e, nb, sizeof(batch_elt_t), batchCompare);
+  for (i = 0; res == 0 && i < nb; i = j) {
+    unsigned int len = e[i].seq->len;
+    size_t states = 2 + e[i].M[MT_START]->frames + e[i].M[MT_STOP]->frames
+		    + 6 * e[i].M[MT_CODING]->order;
+    j = i + 1;
+    while (j < nb && j - i < BATCH_LANES
+	   && !memcmp(e[i].M, e[j].M, sizeof(e[i].M))
+	   && 4 * e[j].seq->len >= 3 * len)
+      j += 1;
+#ifdef __GNUC__
+    if (j - i > 1
+	&& (sizeof(int) * states + sizeof(unsigned int))
+	   * (size_t) len * BATCH_LANES <= FULL_TABLE_MAX) {
+      seq_p_t bSeqs[BATCH_LANES];
+      col_p_t bRc[BATCH_LANES];
+      int bRev[BATCH_LANES], bMax[BATCH_LANES], bad[BATCH_LANES];
+      unsigned int k;
+      int nBad = j - i;
+      for (k = i; k < j; k++) {
+	bSeqs[k - i] = e[k].seq;
+	bRc[k - i] = rc[e[k].i];
+	bRev[k - i] = e[k].rev;
+	bMax[k - i] = maxScore[e[k].i];
+	bad[k - i] = 1;
+      }
+#ifdef HAVE_NARROW
+      if (narrowOk(&sc->p, e[i].M))
+	nBad = batchScan(sc, bSeqs, bRev, nBad, len, bRc, bMax, 1, bad);
+#endif
+      /* The sequences which did not fit a narrow batch get 32-bit
+	 scores.  */
+      if (nBad > 0) {
+	seq_p_t wSeqs[BATCH_LANES];
+	col_p_t wRc[BATCH_LANES];
+	int wRev[BATCH_LANES], wMax[BATCH_LANES], wBad[BATCH_LANES];
+	unsigned int at[BATCH_LANES];
+	nBad = 0;
+	for (k = 0; k < j - i; k++)
+	  if (bad[k]) {
+	    wSeqs[nBad] = bSeqs[k];
+	    wRc[nBad] = bRc[k];
+	    wRev[nBad] = bRev[k];
+	    wMax[nBad] = bMax[k];
+	    at[nBad++] = k;
+	  }
+	if (nBad > 1)
+	  res = batchScan(sc, wSeqs, wRev, nBad, wSeqs[0]->len, wRc, wMax, 0,
+			  wBad);
+	else
+	  res = Compute(sc, wSeqs[0], wRc[0], wRev[0], wMax);
+	for (k = 0; k < (unsigned int) nBad; k++)
+	  bMax[at[k]] = wMax[k];
+      }
+      if (nBad < 0 || res < 0)
+	res = -1;
+      /* Both strands of a sequence may share the batch.  */
+      for (k = i; k < j; k++)
+	maxScore[e[k].i] = max(maxScore[e[k].i], bMax[k - i]);
+      continue;
+    }
+#endif
+    for ( ; res == 0 && i < j; i++)
+      res = Compute(sc, e[i].seq, rc[e[i].i], e[i].rev, maxScore + e[i].i);
+  }
+  free(e);
+  return res;
+}
+
+/* Add to rc a copy of r, which may belong to another column.  */
+int
+copy_result(col_p_t rc, const result_t *r)
+{
+  size_t len = r->s != NULL ? strlen((const char *) r->s) + 1 : 0;
+  size_t aaLen = r->aa != NULL ? strlen(r->aa) + 1 : 0;
+  result_p_t c = newResult(rc, r->nEdits, len, aaLen);
+  if (c == NULL)
+    return -1;
+  c->phase = r->phase;
+  c->score = r->score;
+  c->start = r->start;
+  c->stop = r->stop;
+  c->reverse = r->reverse;
+  if (len > 0)
+    memcpy(c->s, r->s, len);
+  if (aaLen > 0)
+    memcpy(c->aa, r->aa, aaLen);
+  if (r->nEdits > 0)
+    memcpy(c->edits, r->edits, r->nEdits * sizeof(unsigned int));
+  return 0;
+}
+
+void
+free_results(col_p_t rc)
+{
+  unsigned int i;
+  if (rc->arena != NULL) {
+    reset_arena(rc->arena);
+    rc->nb = 0;
+    return;
+  }
+  for (i = 0; i < rc->nb; i++) {
+    result_p_t r = rc->e.r[i];
+    free(r->s);
+    free(r->aa);
+    free(r->edits);
+    free(r);
+  }
+  rc->nb = 0;
+}
+
+/* A compiled model holds the expanded score tables, as built for a given
+   min and Nvalue, so that it can be mapped instead of parsed.  It starts
+   with a header and one smatb_mat_t per matrix, followed by the tables,
+   each aligned on SMATB_ALIGN bytes.  The checksum covers everything
+   after the header.  */
+#define SMATB_MAGIC "ESTScanB"
+#define SMATB_VERSION 1
+#define SMATB_ALIGN 64
+#define SMATB_NAME 64
+
+typedef struct _smatb_head_t {
+  char magic[8];
+  unsigned int version;
+  unsigned int nb;
+  int min;
+  int Nvalue;
+  uint64_t size;
+  uint64_t sum;
+} smatb_head_t;
+
+typedef struct _smatb_mat_t {
+  char name[SMATB_NAME];
+  char kind[SMATB_NAME];
+  double CGmin;
+  double CGmax;
+  int matType;
+  unsigned int order;
+  unsigned int frames;
+  int offset;
+  uint64_t tables;
+} smatb_mat_t;
+
+static uint64_t
+smatbSum(const unsigned char *s, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, s, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+    s += 8;
+    len -= 8;
+  }
+  while (len-- > 0)
+    h = (h ^ *s++) * 0x100000001b3ULL;
+  return h;
+}
+
+static size_t
+tableSize(const matrix_t *m)
+{
+  size_t sSize = 1;
+  unsigned int i;
+  for (i = 0; i < m->order; i++)
+    sSize *= 5;
+  return sSize;
+}
+
+/* Apply the percent correction to the C+G range read from the file.  */
+static void
+setGCRange(matrix_p_t m, const params_t *p, double CGmin, double CGmax)
+{
+  m->CGmin = CGmin;
+  m->CGmax = CGmax;
+  if (m->CGmin < 0.0)
+    m->CGmin = 0.0;
+  if (m->CGmin > 0.0)
+    m->CGmin += p->percent;
+  m->CGmax += p->percent;
+  if (m->CGmax > 100.0)
+    m->CGmax = 100.0;
+}
+
+/* Free m, but for the mapping of its tables.  */
+static void
+freeMatrix(matrix_p_t m)
+{
+  unsigned int j;
+  if (m->map == NULL && m->m != NULL)
+    for (j = 0; j < m->frames; j++)
+      free(m->m[j]);
+  free(m->m);
+  free(m->byCode);
+  free(m->byIndex);
+  free(m->name);
+  free(m->kind);
+  free(m);
+}
+
+/* Add to mc a matrix of p, with its name, kind and tables to be set.
+   Returns NULL on error.  */
+static matrix_p_t
+newMatrix(col_p_t mc, const params_t *p, double CGmin, double CGmax)
+{
+  matrix_p_t m = (matrix_p_t) allocate(sizeof(matrix_t));
+  if (m == NULL)
+    return NULL;
+  memset(m, 0, sizeof(matrix_t));
+  setGCRange(m, p, CGmin, CGmax);
+  if (add_col_elt(mc, m, 16) != 0) {
+    free(m);
+    return NULL;
+  }
+  return m;
+}
+
+static int
+LoadCompiled(const char *fName, int fd, const params_t *p, col_p_t mc)
+{
+  struct stat st;
+  const smatb_head_t *h;
+  const smatb_mat_t *bm;
+  unsigned char *map;
+  unsigned int i;
+  if (fstat(fd, &st) != 0)
+    return failed("Could not stat file %s: %s(%d)\n", fName,
+		  strerror(errno), errno);
+  if ((size_t) st.st_size < sizeof(smatb_head_t))
+    return failed("Compiled model %s is truncated\n", fName);
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return failed("Could not map file %s: %s(%d)\n", fName,
+		  strerror(errno), errno);
+  h = (const smatb_head_t *) map;
+  if (h->version != SMATB_VERSION)
+    failed("Compiled model %s has version %u, expected %u\n",
+	   fName, h->version, SMATB_VERSION);
+  else if (h->size != (uint64_t) st.st_size
+	   || h->nb > ((st.st_size - sizeof(smatb_head_t))
+		       / sizeof(smatb_mat_t)))
+    failed("Compiled model %s is truncated\n", fName);
+  else if (smatbSum(map + sizeof(smatb_head_t),
+		    st.st_size - sizeof(smatb_head_t)) != h->sum)
+    failed("Compiled model %s is corrupt (bad checksum)\n", fName);
+  else if (h->min != p->min || h->Nvalue != p->Nvalue)
+    failed("Compiled model %s was built with -m %d -N %d, "
+	   "recompile it to use -m %d -N %d\n",
+	   fName, h->min, h->Nvalue, p->min, p->Nvalue);
+  else {
+    bm = (const smatb_mat_t *) (map + sizeof(smatb_head_t));
+    for (i = 0; i < h->nb; i++, bm++) {
+      matrix_p_t m;
+      size_t sSize;
+      unsigned int frame;
+      if (bm->order < 1 || bm->order > 13 || bm->frames < 1
+	  || bm->frames > 1024 || bm->tables > h->size) {
+	failed("Bad matrix %u in compiled model %s\n", i, fName);
+	break;
+      }
+      if ((m = newMatrix(mc, p, bm->CGmin, bm->CGmax)) == NULL)
+	break;
+      m->order = bm->order;
+      m->frames = bm->frames;
+      m->map = map;
+      m->mapSize = st.st_size;
+      sSize = tableSize(m);
+      if ((h->size - bm->tables) / m->frames < sSize) {
+	failed("Bad matrix %u in compiled model %s\n", i, fName);
+	break;
+      }
+      m->name = strndup(bm->name, SMATB_NAME - 1);
+      m->kind = strndup(bm->kind, SMATB_NAME - 1);
+      m->matType = bm->matType;
+      m->offset = bm->offset;
+      m->m = (signed char **) allocate(sizeof(signed char *) * m->frames);
+      if (m->name == NULL || m->kind == NULL || m->m == NULL) {
+	failed("Could not load %s: %s(%d)\n", fName, strerror(ENOMEM),
+	       ENOMEM);
+	break;
+      }
+      for (frame = 0; frame < m->frames; frame++)
+	m->m[frame] = (signed char *) map + bm->tables + frame * sSize;
+      if (setByCode(m) != 0)
+	break;
+    }
+    if (i == h->nb)
+      return 0;
+  }
+  /* The matrices added keep the mapping, see FreeMatrices.  */
+  if (mc->nb == 0)
+    munmap(map, st.st_size);
+  return -1;
+}
+
+/* Load the matrices of fName, a text or compiled model, into mc.  mc
+   need not be freed if this fails.  */
+int
+LoadMatrix(const char *fName, const params_t *p, col_p_t mc)
+{
+  read_buf_t rb;
+  char *buf;
+  char magic[sizeof(SMATB_MAGIC) - 1];
+  signed char *data = NULL;
+  int res = 0;
+  int fd = open(fName, O_RDONLY);
+  if (fd == -1)
+    return failed("Could not open file %s: %s(%d)\n", fName,
+		  strerror(errno), errno);
+  if (init_col(mc, 16) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+      && memcmp(magic, SMATB_MAGIC, sizeof(magic)) == 0)
+    res = LoadCompiled(fName, fd, p, mc);
+  else if (init_buf(&rb) != 0)
+    res = -1;
+  else {
+    buf = read_line_buf(&rb, fd);
+    while (res == 0 && buf != NULL && rb.lc > 0) {
+      if (strncmp(buf, "FORMAT: ", 8) == 0) {
+	matrix_p_t m;
+	char name[256], fType[256], mType[256];
+	double CGmin, CGmax;
+	unsigned int order, frames;
+	int offset;
+	unsigned int size = 4096;
+	unsigned int nElt = 0;
+	res = sscanf(buf,
+		     "FORMAT: %255s %255s %255s %u %u %d s C+G: %lf %lf",
+		     name, fType, mType, &order, &frames, &offset,
+		     &CGmin, &CGmax);
+	if (res != 8 || (buf = read_line_buf(&rb, fd)) == NULL
+	    || rb.lc == 0) {
+	  if (res != 8 || buf != NULL)
+	    failed("Bad data header format in file %s, near %s (%d)\n",
+		   fName, res >= 1 ? name : "", res);
+	  res = -1;
+	  break;
+	}
+	res = 0;
+	if ((m = newMatrix(mc, p, CGmin, CGmax)) == NULL
+	    || (data = (signed char *) allocate(sizeof(signed char) * size))
+	       == NULL) {
+	  res = -1;
+	  break;
+	}
+	m->order = order;
+	m->frames = frames;
+	m->offset = offset;
+	m->name = strdup(name);
+	m->kind = strdup(mType);
+	if (m->name == NULL || m->kind == NULL) {
+	  res = failed("Could not load %s: %s(%d)\n", fName,
+		       strerror(ENOMEM), ENOMEM);
+	  break;
+	}
+	m->matType = MT_UNKNOWN;
+	if (strncmp(fType, "CODING", 6) == 0)
+	  m->matType = MT_CODING;
+	if (strncmp(fType, "UNTRANSLATED", 12) == 0)
+	  m->matType = MT_UNTRANSLATED;
+	if (strncmp(fType, "START", 5) == 0)
+	  m->matType = MT_START;
+	if (strncmp(fType, "STOP", 4) == 0)
+	  m->matType = MT_STOP;
+	while (buf[0] == '-' || isdigit(buf[0])) {
+	  int a, c, g, t;
+	  if (sscanf(buf, "%d %d %d %d", &a, &c, &g, &t) != 4) {
+	    res = failed("Bad data format in file %s, near %s\n",
+			 fName, name);
+	    break;
+	  }
+	  if ((buf = read_line_buf(&rb, fd)) == NULL) {
+	    res = -1;
+	    break;
+	  }
+	  if (nElt + 4 > size) {
+	    if (resize(&data, sizeof(signed char) * 2 * size) != 0) {
+	      res = -1;
+	      break;
+	    }
+	    size *= 2;
+	  }
+	  data[nElt++] = a;
+	  data[nElt++] = c;
+	  data[nElt++] = g;
+	  data[nElt++] = t;
+	}
+	if (res == 0)
+	  res = CreateMatrix(m, data, nElt, p);
+	free(data);
+	data = NULL;
+      } else if ((buf = read_line_buf(&rb, fd)) == NULL)
+	res = -1;
+    }
+    if (buf == NULL)
+      res = -1;
+    free(data);
+    free_buf(&rb);
+  }
+  close(fd);
+  if (res != 0)
+    FreeMatrices(mc);
+#ifdef DEBUG
+  else {
+    unsigned int i;
+    fprintf(stderr, "We have loaded %u matrices:\n", mc->nb);
+    for (i = 0; i < mc->nb; i++) {
+      matrix_p_t m = mc->e.m[i];
+      fprintf(stderr, "%u: %s %s %d %.2f %.2f %u %u %d\n", i,
+	      m->name, m->kind, m->matType, m->CGmin, m->CGmax,
+	      m->order, m->frames, m->offset);
+    }
+  }
+#endif
+  return res;
+}
+
+/* Write the matrices of mc, loaded with parameters p, as a compiled model.
+   The C+G ranges are saved as they are, so mc should be loaded with a
+   zero percent.  */
+int
+SaveMatrices(const char *fName, const params_t *p, col_p_t mc)
+{
+  smatb_head_t *h;
+  smatb_mat_t *bm;
+  unsigned char *buf;
+  size_t size = sizeof(smatb_head_t) + mc->nb * sizeof(smatb_mat_t);
+  unsigned int i;
+  int bad;
+  FILE *f;
+  size = (size + SMATB_ALIGN - 1) & ~(size_t) (SMATB_ALIGN - 1);
+  for (i = 0; i < mc->nb; i++) {
+    matrix_p_t m = mc->e.m[i];
+    if (strlen(m->name) >= SMATB_NAME || strlen(m->kind) >= SMATB_NAME)
+      return failed("Matrix name %s %s is too long to be compiled\n",
+		    m->name, m->kind);
+    size += (m->frames * tableSize(m) + SMATB_ALIGN - 1)
+	    & ~(size_t) (SMATB_ALIGN - 1);
+  }
+  if ((buf = (unsigned char *) allocate(size)) == NULL)
+    return -1;
+  memset(buf, 0, size);
+  h = (smatb_head_t *) buf;
+  bm = (smatb_mat_t *) (buf + sizeof(smatb_head_t));
+  size = sizeof(smatb_head_t) + mc->nb * sizeof(smatb_mat_t);
+  size = (size + SMATB_ALIGN - 1) & ~(size_t) (SMATB_ALIGN - 1);
+  for (i = 0; i < mc->nb; i++, bm++) {
+    matrix_p_t m = mc->e.m[i];
+    size_t sSize = tableSize(m);
+    unsigned int frame;
+    strcpy(bm->name, m->name);
+    strcpy(bm->kind, m->kind);
+    bm->CGmin = m->CGmin;
+    bm->CGmax = m->CGmax;
+    bm->matType = m->matType;
+    bm->order = m->order;
+    bm->frames = m->frames;
+    bm->offset = m->offset;
+    bm->tables = size;
+    for (frame = 0; frame < m->frames; frame++)
+      memcpy(buf + size + frame * sSize, m->m[frame], sSize);
+    size += (m->frames * sSize + SMATB_ALIGN - 1)
+	    & ~(size_t) (SMATB_ALIGN - 1);
+  }
+  memcpy(h->magic, SMATB_MAGIC, sizeof(h->magic));
+  h->version = SMATB_VERSION;
+  h->nb = mc->nb;
+  h->min = p->min;
+  h->Nvalue = p->Nvalue;
+  h->size = size;
+  h->sum = smatbSum(buf + sizeof(smatb_head_t), size - sizeof(smatb_head_t));
+  f = fopen(fName, "wb");
+  if (f == NULL) {
+    free(buf);
+    return failed("Could not create file %s: %s(%d)\n", fName,
+		  strerror(errno), errno);
+  }
+  bad = fwrite(buf, 1, size, f) != size;
+  if (fclose(f) != 0 || bad) {
+    free(buf);
+    return failed("Could not write file %s: %s(%d)\n", fName,
+		  strerror(errno), errno);
+  }
+  free(buf);
+  return 0;
+}
+
+void
+FreeMatrices(col_p_t mc)
+{
+  unsigned int i;
+  for (i = 0; i < mc->nb; i++) {
+    matrix_p_t m = mc->e.m[i];
+    if (i == mc->nb - 1 && m->map != NULL)
+      munmap(m->map, m->mapSize);
+    freeMatrix(m);
+  }
+  free_col(mc);
+}
+
+void
+remove_lc(unsigned char *s)
+{
+  unsigned char *t = s;
+  while (*s) {
+    if (isupper(*s))
+      *t++ = *s;
+    s += 1;
+  }
+  *t = 0;
+}
+
+/* Translate s into res, which must hold strlen(s) / 3 + 2 chars.  An
+   incomplete last codon is translated as if completed by N's.  */
+char *
+na2aa(const unsigned char *s, char *res)
+{
+  char *cur = res;
+  while (*s) {
+    unsigned int codon = dna_code[*s++] * 25;
+    if (*s) {
+      codon += dna_code[*s++] * 5;
+      codon += *s ? dna_code[*s++] : dna_code['N'];
+    } else
+      codon += dna_code['N'] * 6;
+    *cur++ = codon_aa[codon];
+  }
+  *cur = 0;
+  return res;
+}
+